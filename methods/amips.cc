@@ -1,16 +1,209 @@
 #include "amips.h"
+#include "parallel.h"
+
+#include <memory>
+#include <sys/stat.h>
 
 namespace mips {
 
+// perf counters of query loops (-perf), closed at exit
+static std::unique_ptr<Perf_Counters> s_perf;
+
+// -----------------------------------------------------------------------------
+static float percentile(			// latency at a percentile (nearest rank)
+	const std::vector<float> &sorted,	// latencies (ascending)
+	float p)							// percentile in (0, 1]
+{
+	int n   = (int) sorted.size();
+	int idx = (int) ceil(p * n) - 1;
+	return sorted[MAX(0, MIN(idx, n - 1))];
+}
+
+// -----------------------------------------------------------------------------
+//  the latency bins double in width: bin 0 holds latencies below LAT_BIN_MS, 
+//  bin i holds [LAT_BIN_MS * 2^(i-1), LAT_BIN_MS * 2^i), and the last bin 
+//  holds everything above.
+// -----------------------------------------------------------------------------
+static float lat_edge(				// upper edge of a latency bin (ms)
+	int   bin)							// bin id in [0, LAT_BINS-1)
+{
+	return LAT_BIN_MS * (float) ldexp(1.0, bin);
+}
+
+// -----------------------------------------------------------------------------
+//  run_batches: answer qn queries in batches of batch queries on 
+//  g_query_threads threads. search(tid, start, num, list) answers the queries 
+//  [start, start+num) into list[0, num), the lists of thread tid. it sets 
+//  g_ratio, g_recall, g_runtime (ms per query), g_qps, the latencies g_p50, 
+//  g_p95, g_p99, and g_max (ms), and the latency histogram g_lat_hist.
+//
+//  each search is timed by a steady clock; the queries of a batch share its 
+//  latency, since none of them is answered before the batch ends.
+// -----------------------------------------------------------------------------
+template<class Search>
+static void run_batches(			// answer queries by search
+	int   qn,							// number of queries
+	int   top_k,						// top-k value
+	int   batch,						// batch size
+	const Result **R,					// MIP ground truth results
+	Search search)						// search(tid, start, num, list)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	int num_threads = MAX(g_query_threads, 1);
+	std::vector<MaxK_List*> lists((int64_t) num_threads * batch);
+	for (auto &list : lists) list = new MaxK_List(top_k);
+	std::vector<float> ratio(qn), recall(qn), latency(qn);
+
+#ifdef MIPS_STATS
+	stats_reset();
+#endif
+	if (g_perf && !s_perf) s_perf.reset(new Perf_Counters());
+	if (g_perf) s_perf->start();
+	Clock::time_point start_time = Clock::now();
+	parallel_for((qn + batch - 1) / batch, 1, [&](int tid, int begin, int end) {
+		MaxK_List **list = &lists[(int64_t) tid * batch];
+		for (int b = begin; b < end; ++b) {
+			int start = b * batch;
+			int num   = MIN(batch, qn - start);
+			for (int i = 0; i < num; ++i) list[i]->reset();
+
+			Clock::time_point t0 = Clock::now();
+			search(tid, start, num, list);
+			float ms = std::chrono::duration<float, std::milli>(
+				Clock::now() - t0).count();
+
+			for (int i = 0; i < num; ++i) {
+				ratio[start + i]   = calc_ratio(top_k,  R[start + i], list[i]);
+				recall[start + i]  = calc_recall(top_k, R[start + i], list[i]);
+				latency[start + i] = ms;
+			}
+		}
+	}, num_threads);
+	if (g_perf) s_perf->stop(qn);
+#ifdef MIPS_STATS
+	STATS_ADD(queries_, qn);
+	stats_flush();
+#endif
+	float runtime = std::chrono::duration<float>(Clock::now() - 
+		start_time).count();
+
+	// sum up in query order, so that the results do not depend on threads
+	g_ratio  = 0.0f;
+	g_recall = 0.0f;
+	for (int i = 0; i < qn; ++i) { g_ratio += ratio[i]; g_recall += recall[i]; }
+
+	g_ratio   = g_ratio / qn;
+	g_recall  = g_recall / qn;
+	g_runtime = (runtime * 1000.0f) / qn;
+	g_qps     = runtime > 0.0f ? qn / runtime : 0.0f;
+
+	g_p50 = g_p95 = g_p99 = g_max = 0.0f;
+	if (qn > 0) {
+		std::sort(latency.begin(), latency.end());
+		g_p50 = percentile(latency, 0.50f);
+		g_p95 = percentile(latency, 0.95f);
+		g_p99 = percentile(latency, 0.99f);
+		g_max = latency[qn - 1];
+	}
+	memset(g_lat_hist, 0, sizeof(g_lat_hist));
+	for (int i = 0, bin = 0; i < qn; ++i) { // latency is sorted
+		while (bin < LAT_BINS - 1 && latency[i] >= lat_edge(bin)) ++bin;
+		++g_lat_hist[bin];
+	}
+
+	for (auto &list : lists) { delete list; list = NULL; }
+}
+
+// -----------------------------------------------------------------------------
+template<class Search>
+static void run_queries(			// answer queries one by one by search
+	int   qn,							// number of queries
+	int   top_k,						// top-k value
+	const Result **R,					// MIP ground truth results
+	Search search)						// search(tid, i, list)
+{
+	run_batches(qn, top_k, 1, R, [&](int tid, int start, int /*num*/, 
+		MaxK_List **list) { search(tid, start, list[0]); });
+}
+
+// -----------------------------------------------------------------------------
+static void write_latency(			// append the latency histogram to a table
+	const char *out_path,				// output path
+	const char *method_name,			// name of method
+	int   top_k)						// top-k value
+{
+	// -------------------------------------------------------------------------
+	//  one tab-separated line per (method, top-k): the number of queries in 
+	//  each latency bin, labeled by its upper edge in ms
+	// -------------------------------------------------------------------------
+	char fname[200];
+	sprintf(fname, "%slatency.tsv", out_path);
+
+	struct stat st;
+	bool  exists = stat(fname, &st) == 0;
+	FILE *fp = fopen(fname, "a+");
+	if (!fp) { printf("Could not create %s\n", fname); return; }
+
+	if (!exists) {
+		fprintf(fp, "method\ttop_k");
+		for (int i = 0; i < LAT_BINS - 1; ++i) {
+			fprintf(fp, "\t<%.2f", lat_edge(i));
+		}
+		fprintf(fp, "\t>=%.2f\n", lat_edge(LAT_BINS - 2));
+	}
+	fprintf(fp, "%s\t%d", method_name, top_k);
+	for (int i = 0; i < LAT_BINS; ++i) fprintf(fp, "\t%d", g_lat_hist[i]);
+	fprintf(fp, "\n");
+	fclose(fp);
+}
+
+// -----------------------------------------------------------------------------
+static void print_round(			// print the results of one top-k value
+	FILE  *fp,							// output file
+	const char *out_path,				// output path
+	const char *method_name,			// name of method
+	int   top_k)						// top-k value
+{
+#ifdef MIPS_STATS
+	write_stats(out_path, method_name, top_k);
+#endif
+	printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\t\t%.1f\t\t%.4f\t%.4f\t%.4f\t"
+		"%.4f\n", top_k, g_ratio, g_runtime, g_recall, g_qps, g_p50, g_p95, 
+		g_p99, g_max);
+	fprintf(fp, "%d\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\n", top_k, g_ratio, 
+		g_runtime, g_recall, g_qps, g_p50, g_p95, g_p99, g_max);
+	write_latency(out_path, method_name, top_k);
+	if (g_perf) s_perf->write(out_path, method_name, top_k);
+}
+
+// -----------------------------------------------------------------------------
+static QALSH_Scratch **new_scratch() // working space of each query thread
+{
+	int num_threads = MAX(g_query_threads, 1);
+	QALSH_Scratch **scratch = new QALSH_Scratch*[num_threads];
+
+	scratch[0] = NULL;				// thread 0 uses the one of the index
+	for (int i = 1; i < num_threads; ++i) scratch[i] = new QALSH_Scratch(0, 0);
+	return scratch;
+}
+
+// -----------------------------------------------------------------------------
+static void delete_scratch(			// release the working space of threads
+	QALSH_Scratch **scratch)			// returned by new_scratch
+{
+	int num_threads = MAX(g_query_threads, 1);
+	for (int i = 0; i < num_threads; ++i) delete scratch[i];
+	delete[] scratch;
+}
+
 // -----------------------------------------------------------------------------
 int ground_truth(					// find the ground truth MIP results
 	int   n,							// number of data objects
 	int   qn,							// number of query points
 	int   d,							// dimensionality
-	const float **data,					// data objects
-	const float **norm_d,				// l2-norm of data objects
-	const float **query,				// query objects
-	const float **norm_q,				// l2-norm of query objects
+	const Dataset *data,				// data objects
+	const Dataset *query,				// query objects
 	const char  *truth_set) 			// address of truth set
 {
 	gettimeofday(&g_start_time, NULL);
@@ -23,32 +216,89 @@ int ground_truth(					// find the ground truth MIP results
 	Result *order_d = new Result[n];
 	for (int i = 0; i < n; ++i) {
 		order_d[i].id_  = i;
-		order_d[i].key_ = norm_d[i][0];
+		order_d[i].key_ = data->norm(i)[0];
 	}
 	qsort(order_d, n, sizeof(Result), ResultCompDesc);
 
 	// -------------------------------------------------------------------------
-	//  find ground truth results (using linear scan method)
+	//  find ground truth results by a blocked matrix product. tiles of data 
+	//  (about TILE_BYTES, in descending order of norms) are handed out to 
+	//  threads; each thread keeps its own top-k lists (k = g_max_k) of all 
+	//  queries, and computes a tile against QUERY_TILE queries at a time, 
+	//  skipping the queries whose k-th inner product is not below the norm 
+	//  bound of the tile. the lists of all threads are merged at the end
 	// -------------------------------------------------------------------------
-	MaxK_List *list = new MaxK_List(MAXK);
+	const int QUERY_TILE = 64;		// number of queries per tile
+	const int TILE_BYTES = 1 << 18;	// size of a tile of data (bytes)
+	int data_tile = MAX(16, TILE_BYTES / (SIZEFLOAT * MAX(d, 1)) / 4 * 4);
+	int num_tiles = (n + data_tile - 1) / data_tile;
+	int threads   = MAX(1, MIN(g_num_threads, num_tiles));
+
+	const float **row_d = new const float*[n];
+	const float **row_q = new const float*[qn];
+	int *id_d = new int[n];
+	for (int j = 0; j < n; ++j) {
+		row_d[j] = data->row(order_d[j].id_);
+		id_d[j]  = order_d[j].id_;
+	}
+	for (int i = 0; i < qn; ++i) row_q[i] = query->row(i);
+
+	std::vector<MaxK_List*> lists((int64_t) threads * qn);
+	std::vector<float> kips((int64_t) threads * qn, MINREAL);
+	std::vector<std::vector<float> > blocks(threads);
+	for (size_t j = 0; j < lists.size(); ++j) lists[j] = new MaxK_List(g_max_k);
+
+	parallel_for(num_tiles, 1, [&](int tid, int begin, int end) {
+		MaxK_List **list = &lists[(int64_t) tid * qn];
+		float *kip = &kips[(int64_t) tid * qn];
+		std::vector<float> &block = blocks[tid];
+		block.resize((int64_t) QUERY_TILE * data_tile);
+
+		const float *qs[QUERY_TILE];
+		int   qid[QUERY_TILE];
+		for (int tile = begin; tile < end; ++tile) {
+			int   start = tile * data_tile;
+			int   cnt   = MIN(data_tile, n - start);
+			float max_norm = order_d[start].key_;
+
+			for (int base = 0; base < qn; base += QUERY_TILE) {
+				int num = 0;
+				for (int i = base; i < MIN(base + QUERY_TILE, qn); ++i) {
+					if (max_norm * query->norm(i)[0] > kip[i]) {
+						qid[num] = i; qs[num] = row_q[i]; ++num;
+					}
+				}
+				if (num == 0) continue;
+
+				g_ip.ip_block_(d, num, qs, cnt, row_d + start, &block[0]);
+				for (int a = 0; a < num; ++a) {
+					int q = qid[a];
+					kip[q] = list[q]->insert_block(cnt, &block[(int64_t) a * cnt],
+						id_d + start, 1);
+				}
+			}
+		}
+	}, threads);
 
-	fprintf(fp, "%d %d\n", qn, MAXK);
+	MaxK_List *list = new MaxK_List(g_max_k);
+	fprintf(fp, "%d %d\n", qn, g_max_k);
 	for (int i = 0; i < qn; ++i) {
-		float kip = MINREAL;
 		list->reset();
-		for (int j = 0; j < n; ++j) {
- 			int id = order_d[j].id_;
-			if (norm_d[id][0] * norm_q[i][0] <= kip) break;
-
-			float ip = calc_inner_product(d, kip, data[id], norm_d[id], 
-				query[i], norm_q[i]);
-			kip = list->insert(ip, id + 1);
+		for (int t = 0; t < threads; ++t) {
+			MaxK_List *part = lists[(int64_t) t * qn + i];
+			for (int j = 0; j < part->size(); ++j) {
+				list->insert(part->ith_key(j), part->ith_id(j));
+			}
 		}
 		for (int j = 0; j < list->size(); ++j) {
 			fprintf(fp, "%d %f ", list->ith_id(j), list->ith_key(j));
 		}
 		fprintf(fp, "\n");
 	}
+	for (size_t j = 0; j < lists.size(); ++j) delete lists[j];
+	delete[] row_d;
+	delete[] row_q;
+	delete[] id_d;
 	delete[] order_d; 
 	delete   list;
 	fclose(fp);
@@ -66,12 +316,11 @@ int linear_scan(					// k-MIP search by linear_scan
 	int   n,							// number of data objects
 	int   qn,							// number of query objects
 	int   d,							// dimensionality
+	int   batch,						// batch size of queries (1: one by one)
 	const char *method_name,			// name of method
 	const char *out_path,				// output path
-	const float **data,					// data objects
-	const float **norm_d,				// l2-norm of data objects
-	const float **query,				// query objects
-	const float **norm_q,				// l2-norm of query objects
+	const Dataset *data,				// data objects
+	const Dataset *query,				// query objects
 	const Result **R)					// MIP ground truth results
 {
 	char output_set[200];
@@ -81,58 +330,32 @@ int linear_scan(					// k-MIP search by linear_scan
 	if (!fp) { printf("Could not create %s\n", output_set); return 1; }
 
 	// -------------------------------------------------------------------------
-	//  calc the norm of data
+	//  copy data objects in descending order of norms
 	// -------------------------------------------------------------------------
-	Result *order_d = new Result[n];
-	for (int i = 0; i < n; ++i) {
-		order_d[i].id_  = i;
-		order_d[i].key_ = norm_d[i][0];
-	}
-	qsort(order_d, n, sizeof(Result), ResultCompDesc);
+	Linear_Scan *scan = new Linear_Scan(n, d, data->rows(), data->norms());
+	scan->display();
+
+	const float **q      = query->rows();
+	const float **norm_q = query->norms();
 
 	// -------------------------------------------------------------------------
 	//  k-MIPS of linear_scan
 	// -------------------------------------------------------------------------
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List *list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			float kip = MINREAL;
-			list->reset();
-			for (int j = 0; j < n; ++j) {
-				int id = order_d[j].id_;
-				if (norm_d[id][0] * norm_q[i][0] <= kip) break;
-				
-				float ip = calc_inner_product(d, kip, data[id], norm_d[id], 
-					query[i], norm_q[i]);
-				kip = list->insert(ip, id + 1);
-			}
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_batches(qn, top_k, batch, R, [&](int /*tid*/, int start, int size, 
+			MaxK_List **list) {
+			scan->kmip_batch(size, top_k, q + start, norm_q + start, list);
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
-	delete[] order_d;
+	delete scan;
 
 	return 0;
 }
@@ -181,38 +404,21 @@ int l2_alsh(						// k-MIP search by l2_alsh
 	// -------------------------------------------------------------------------
 	//  k-MIPS of l2_alsh
 	// -------------------------------------------------------------------------	
+	QALSH_Scratch **scratch = new_scratch();
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], list, scratch[tid]);
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
+	delete_scratch(scratch);
 	delete lsh;
 
 	return 0;
@@ -262,38 +468,21 @@ int l2_alsh2(						// k-MIP search by l2_alsh2
 	// -------------------------------------------------------------------------
 	//  k-MIPS of l2_alsh2
 	// -------------------------------------------------------------------------	
+	QALSH_Scratch **scratch = new_scratch();
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int tid, int i, MaxK_List *list) {
+			lsh->kmip(top_k, query[i], norm_q[i], list, scratch[tid]);
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
+	delete_scratch(scratch);
 	delete lsh;
 
 	return 0;
@@ -343,34 +532,16 @@ int xbox(							// k-MIP search by xbox
 	fprintf(fp, "Indexing Time: %f Seconds\n", g_indextime);
 	fprintf(fp, "Estimated Memory: %f MB\n", g_memory);
 
+	QALSH_Scratch **scratch = new_scratch();
 	printf("k-MIPS of %s:\n", method_name1);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			xbox->kmip(top_k, false, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int tid, int i, MaxK_List *list) {
+			xbox->kmip(top_k, false, query[i], norm_q[i], list, scratch[tid]);
+		});
+		print_round(fp, out_path, method_name1, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -388,37 +559,19 @@ int xbox(							// k-MIP search by xbox
 	fprintf(fp, "Estimated Memory: %f MB\n", g_memory);
 
 	printf("k-MIPS of %s:\n", method_name2);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			xbox->kmip(top_k, true, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int tid, int i, MaxK_List *list) {
+			xbox->kmip(top_k, true, query[i], norm_q[i], list, scratch[tid]);
+		});
+		print_round(fp, out_path, method_name2, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
+	delete_scratch(scratch);
 	delete xbox;
 
 	return 0;
@@ -469,33 +622,14 @@ int sign_alsh(						// k-MIP search by sign_alsh
 	//  k-MIPS of sign_alsh
 	// -------------------------------------------------------------------------
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int /*tid*/, int i, MaxK_List *list) {
 			lsh->kmip(top_k, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -548,33 +682,14 @@ int simple_lsh(						// k-MIP search by simple_lsh
 	//  k-MIPS of simple_lsh
 	// -------------------------------------------------------------------------	
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List *list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_queries(qn, top_k, R, [&](int /*tid*/, int i, MaxK_List *list) {
 			lsh->kmip(top_k, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
@@ -591,6 +706,8 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	int   d,							// dimensionality
 	float nn_ratio,						// approximation ratio for ANN search
 	float mip_ratio,					// approximation ratio for AMIP search
+	int   batch,						// batch size of queries (1: one by one)
+	const char *index_file,				// index file ("": build the index)
 	const char *method_name,			// name of method
 	const char *out_path,				// output path
 	const float **data,					// data objects
@@ -606,10 +723,14 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	if (!fp) { printf("Could not create %s\n", output_set); return 1; }
 
 	// -------------------------------------------------------------------------
-	//  indexing
+	//  indexing: load the index file if it matches the parameters and the 
+	//  data; otherwise, build the index and save it for the next run
 	// -------------------------------------------------------------------------
 	gettimeofday(&g_start_time, NULL);
-	H2_ALSH *lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d);
+	H2_ALSH *lsh = NULL;
+	bool loaded = index_file[0] != '\0' && H2_ALSH::load(index_file, n, d, 
+		nn_ratio, mip_ratio, data, norm_d, &lsh) == 0;
+	if (!loaded) lsh = new H2_ALSH(n, d, nn_ratio, mip_ratio, data, norm_d);
 	lsh->display();
 
 	gettimeofday(&g_end_time, NULL);
@@ -617,6 +738,10 @@ int h2_alsh(						// k-MIP search by h2_alsh
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
 	g_memory = lsh->get_memory_usage() / 1048576.0f;
 
+	if (loaded) printf("Load Index:       %s\n", index_file);
+	else if (index_file[0] != '\0' && lsh->save(index_file) == 0) {
+		printf("Save Index:       %s\n", index_file);
+	}
 	printf("Indexing Time:    %f Seconds\n", g_indextime);
 	printf("Estimated Memory: %f MB\n\n", g_memory);
 
@@ -627,38 +752,29 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	// -------------------------------------------------------------------------
 	//  k-MIPS of h2_alsh
 	// -------------------------------------------------------------------------	
+	QALSH_Scratch **scratch = new_scratch();
 	printf("k-MIPS of %s:\n", method_name);
-	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\n");
-	for (int num = 0; num < MAX_ROUND; ++num) {
-		gettimeofday(&g_start_time, NULL);
-		int top_k = TOPK[num];
-		MaxK_List* list = new MaxK_List(top_k);
-
-		g_ratio  = 0.0f;
-		g_recall = 0.0f;
-		for (int i = 0; i < qn; ++i) {
-			list->reset();
-			lsh->kmip(top_k, query[i], norm_q[i], list);
-
-			g_ratio  += calc_ratio(top_k,  R[i], list);
-			g_recall += calc_recall(top_k, R[i], list);
-		}
-		delete list; list = NULL;
-		gettimeofday(&g_end_time, NULL);
-		g_runtime = g_end_time.tv_sec - g_start_time.tv_sec + 
-			(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
-
-		g_ratio   = g_ratio / qn;
-		g_recall  = g_recall / qn;
-		g_runtime = (g_runtime * 1000.0f) / qn;
-
-		printf("  %3d\t\t%.4f\t\t%.4f\t\t%.2f%%\n", top_k, g_ratio, 
-			g_runtime, g_recall);
-		fprintf(fp, "%d\t%f\t%f\t%f\n", top_k, g_ratio, g_runtime, g_recall);
+	printf("  Top-k\t\tRatio\t\tTime (ms)\tRecall\t\tQPS\t\t"
+		"p50 (ms)\tp95 (ms)\tp99 (ms)\tmax (ms)\n");
+	for (int num = 0; num < (int) g_topk.size(); ++num) {
+		int top_k = g_topk[num];
+		run_batches(qn, top_k, batch, R, [&](int tid, int start, int size, 
+			MaxK_List **list) {
+			if (batch == 1) {
+				lsh->kmip(top_k, query[start], norm_q[start], list[0], 
+					scratch[tid]);
+			}
+			else {
+				lsh->kmip_batch(size, top_k, query + start, norm_q + start, 
+					list, scratch[tid]);
+			}
+		});
+		print_round(fp, out_path, method_name, top_k);
 	}
 	printf("\n");
 	fprintf(fp, "\n");
 	fclose(fp);
+	delete_scratch(scratch);
 	delete lsh;
 
 	return 0;
@@ -2,17 +2,23 @@
 
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+#include <vector>
 #include <sys/time.h>
 
 #include "def.h"
 #include "util.h"
 #include "pri_queue.h"
+#include "dataset.h"
+#include "stats.h"
+#include "perf.h"
 #include "h2_alsh.h"
 #include "l2_alsh.h"
 #include "l2_alsh2.h"
 #include "xbox.h"
 #include "sign_alsh.h"
 #include "simple_lsh.h"
+#include "linear_scan.h"
 
 namespace mips {
 
@@ -21,10 +27,8 @@ int ground_truth(					// find the ground truth MIP results
 	int   n,							// number of data objects
 	int   qn,							// number of query points
 	int   d,							// dimensionality
-	const float **data,					// data objects
-	const float **norm_d,				// l2-norm of data objects
-	const float **query,				// query objects
-	const float **norm_q,				// l2-norm of query objects
+	const Dataset *data,				// data objects
+	const Dataset *query,				// query objects
 	const char  *truth_set);			// address of truth set
 	
 // -----------------------------------------------------------------------------
@@ -32,12 +36,11 @@ int linear_scan(					// k-MIP search by linear scan
 	int   n,							// number of data objects
 	int   qn,							// number of query objects
 	int   d,							// dimensionality
+	int   batch,						// batch size of queries (1: one by one)
 	const char *method_name,			// name of method
 	const char *out_path,				// output path
-	const float **data,					// data objects
-	const float **norm_d,				// l2-norm of data objects
-	const float **query,				// query objects
-	const float **norm_q,				// l2-norm of query objects
+	const Dataset *data,				// data objects
+	const Dataset *query,				// query objects
 	const Result **R);					// MIP ground truth results
 
 // -----------------------------------------------------------------------------
@@ -124,6 +127,8 @@ int h2_alsh(						// k-MIP search by h2_alsh
 	int   d,							// dimensionality
 	float nn_ratio,						// approximation ratio for ANN search
 	float mip_ratio,					// approximation ratio for AMIP search
+	int   batch,						// batch size of queries (1: one by one)
+	const char *index_file,				// index file ("": build the index)
 	const char *method_name,			// name of method
 	const char *out_path,				// output path
 	const float **data,					// data objects
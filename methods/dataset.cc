@@ -0,0 +1,133 @@
+#include "dataset.h"
+#include "simd.h"
+
+namespace mips {
+
+const int     ALIGNMENT      = 64;	// alignment of rows (bytes)
+const int64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024; // size of a huge page (bytes)
+
+// -----------------------------------------------------------------------------
+Dataset::Dataset(					// constructor
+	int   n,							// number of objects
+	int   d,							// dimensionality
+	bool  huge_page)					// use huge pages for data_
+	: n_(n), d_(d), huge_page_(huge_page)
+{
+	alloc_arena();
+	init_norms();
+}
+
+// -----------------------------------------------------------------------------
+Dataset::Dataset(					// constructor (adopt a file mapping)
+	int   n,							// number of objects
+	int   d,							// dimensionality
+	void  *addr,						// start address of mapping
+	int64_t bytes)						// size of mapping (bytes)
+	: n_(n), d_(d), stride_(d), huge_page_(false), bytes_(bytes), 
+	mapped_(true)
+{
+	data_ = (float *) addr;
+	init_norms();
+}
+
+// -----------------------------------------------------------------------------
+void Dataset::alloc_arena()			// allocate a padded arena for data_
+{
+	// -------------------------------------------------------------------------
+	//  allocate one aligned arena for data, rows are padded to 64 bytes
+	// -------------------------------------------------------------------------
+	int align = ALIGNMENT / SIZEFLOAT;
+	stride_ = (d_ + align - 1) / align * align;
+	bytes_  = (int64_t) n_ * stride_ * SIZEFLOAT;
+	mapped_ = false;
+	data_   = NULL;
+
+	if (huge_page_) {
+		int64_t size = (bytes_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+			HUGE_PAGE_SIZE;
+		void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr == MAP_FAILED) {
+			// no reserved huge pages, fall back to transparent huge pages
+			ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (ptr != MAP_FAILED) madvise(ptr, size, MADV_HUGEPAGE);
+		}
+		if (ptr != MAP_FAILED) {
+			data_   = (float *) ptr;
+			bytes_  = size;
+			mapped_ = true;
+		}
+		else {
+			printf("Could not allocate huge pages, use normal pages\n");
+			huge_page_ = false;
+		}
+	}
+	if (!mapped_) {
+		void *ptr = NULL;
+		if (posix_memalign(&ptr, ALIGNMENT, MAX(bytes_, ALIGNMENT)) != 0) {
+			printf("Could not allocate %lld bytes\n", (long long) bytes_);
+			exit(1);
+		}
+		data_ = (float *) ptr;
+	}
+	memset(data_, 0, bytes_);		// zero the padding of each row
+}
+
+// -----------------------------------------------------------------------------
+void Dataset::release_arena()		// release the arena of data_
+{
+	if (mapped_) munmap(data_, bytes_);
+	else free(data_);
+	data_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void Dataset::init_norms()			// allocate norm_ and init row views
+{
+	norm_k_    = get_norm_k();
+	norm_      = new float[(int64_t) n_ * norm_k_];
+	rows_      = new float*[n_];
+	norm_rows_ = new float*[n_];
+	for (int i = 0; i < n_; ++i) {
+		rows_[i]      = row(i);
+		norm_rows_[i] = norm(i);
+	}
+}
+
+// -----------------------------------------------------------------------------
+Dataset::~Dataset()					// destructor
+{
+	release_arena();
+
+	delete[] norm_;      norm_      = NULL;
+	delete[] rows_;      rows_      = NULL;
+	delete[] norm_rows_; norm_rows_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void Dataset::permute_dims(			// permute the dimensions of all objects
+	const int *perm)					// new dim j is old dim perm[j]
+{
+	// -------------------------------------------------------------------------
+	//  copy into a new (padded, writable) arena, so that a read-only file 
+	//  mapping is never modified; l2-norms must be re-calculated by the caller
+	// -------------------------------------------------------------------------
+	float   *old_data   = data_;
+	int64_t old_bytes   = bytes_;
+	bool    old_mapped  = mapped_;
+	int     old_stride  = stride_;
+
+	alloc_arena();
+	for (int i = 0; i < n_; ++i) {
+		const float *src = old_data + (int64_t) i * old_stride;
+		float *dst = row(i);
+		for (int j = 0; j < d_; ++j) dst[j] = src[perm[j]];
+		rows_[i] = dst;
+	}
+
+	if (old_mapped) munmap(old_data, old_bytes);
+	else free(old_data);
+}
+
+} // end namespace mips
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+#include <sys/mman.h>
+
+#include "def.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  Dataset: a row-major matrix of n objects in d dimensions together with the
+//  partial l2-norms of each object.
+//
+//  all objects are stored in one 64-byte aligned arena with a fixed row stride
+//  (rounded up to 16 floats), optionally backed by huge pages, so that a scan
+//  over the data walks contiguous memory. the (float **) row views used by the
+//  existing methods are still provided by rows_ and norm_rows_.
+//
+//  a Dataset can also adopt a read-only mapping of a raw binary file, in which
+//  case the rows are not padded (stride_ = d_) and the pages are shared with
+//  the page cache of other processes.
+//
+//  the number of l2-norms per object (norm_k_) follows the pruning schedule 
+//  g_prune at the time of construction.
+// -----------------------------------------------------------------------------
+class Dataset {
+public:
+	int   n_;						// number of objects
+	int   d_;						// dimensionality
+	int   stride_;					// row stride of data_ (number of floats)
+	int   norm_k_;					// number of l2-norms per object
+	bool  huge_page_;				// whether data_ is backed by huge pages
+	float *data_;					// data objects (n_ * stride_ floats)
+	float *norm_;					// l2-norms of objects (n_ * norm_k_ floats)
+	float **rows_;					// row views of data_
+	float **norm_rows_;				// row views of norm_
+
+	// -------------------------------------------------------------------------
+	Dataset(						// constructor
+		int   n,						// number of objects
+		int   d,						// dimensionality
+		bool  huge_page = false);		// use huge pages for data_
+
+	// -------------------------------------------------------------------------
+	Dataset(						// constructor (adopt a file mapping)
+		int   n,						// number of objects
+		int   d,						// dimensionality
+		void  *addr,					// start address of mapping
+		int64_t bytes);					// size of mapping (bytes)
+
+	// -------------------------------------------------------------------------
+	~Dataset();						// destructor
+
+	// -------------------------------------------------------------------------
+	void permute_dims(				// permute the dimensions of all objects
+		const int *perm);				// new dim j is old dim perm[j]
+
+	// -------------------------------------------------------------------------
+	inline float *row(int i) const { return data_ + (int64_t) i * stride_; }
+
+	// -------------------------------------------------------------------------
+	inline float *norm(int i) const { return norm_ + (int64_t) i * norm_k_; }
+
+	// -------------------------------------------------------------------------
+	inline const float **rows() const { return (const float **) rows_; }
+
+	// -------------------------------------------------------------------------
+	inline const float **norms() const { return (const float **) norm_rows_; }
+
+	// -------------------------------------------------------------------------
+	int64_t get_memory_usage()		// get memory usage
+	{
+		int64_t ret = 0;
+		ret += sizeof(*this);
+		ret += bytes_;				// for data_
+		ret += SIZEFLOAT * n_ * norm_k_; // for norm_
+		ret += sizeof(float*) * n_ * 2; // for rows_ and norm_rows_
+		return ret;
+	}
+
+protected:
+	int64_t bytes_;					// size of the arena of data_ (bytes)
+	bool    mapped_;				// whether data_ is allocated by mmap
+
+	// -------------------------------------------------------------------------
+	void alloc_arena();				// allocate a padded arena for data_
+
+	// -------------------------------------------------------------------------
+	void release_arena();			// release the arena of data_
+
+	// -------------------------------------------------------------------------
+	void init_norms();				// allocate norm_ and init row views
+};
+
+} // end namespace mips
@@ -32,18 +32,32 @@ const int   SIZEUINT64    = (int) sizeof(uint64_t);
 const float E             = 2.7182818F;
 const float PI            = 3.141592654F;
 const float FLOATZERO     = 1e-6F;
+const float RELZERO       = 1e-5F; // relative tolerance of inner products
 const float ANGLE         = PI / 8.0f;
 
-const int   TOPK[]        = { 1,2,5,10 };
-const int   MAX_ROUND     = sizeof(TOPK) / sizeof(int);
-const int   MAXK          = TOPK[MAX_ROUND-1];
 const int   tMIPs[]       = { 1,2,5,10,20,30,40,50,60,70,80,90,100,200,500,1000 };
 const int   MAX_T         = sizeof(tMIPs) / sizeof(int);
 
-const int   NORM_K        = 3;
+const int   PRUNE_STEP    = 8;
+const int   PRUNE_NUM     = 2;
+const int   MAX_NORM_K    = 33;
 const int   SCAN_SIZE     = 512;
 const int   CANDIDATES    = 100;
+const int   CAND_PER_K    = 10;
 const int   MAX_BLOCK_NUM = 5000;
 const int   N_THRESHOLD   = CANDIDATES * 4;
+const int   VECS_CHUNK    = 4096;
+const int   MIH_MAX_BITS  = 24;
+const int   MIH_PROBE_COST = 32;
+const int   LS_TILE_BYTES = 1 << 16;
+const int   LS_QUERY_TILE = 64;
+const int   TOPK_SORTED_MAX = 64;
+const int   TOPK_HEAP_MAX = 256;
+const int   TOPK_BLOCK    = 256;
+const int   INDEX_VERSION = 1;
+const int   INDEX_PAGE    = 4096;
+const int   INDEX_ALIGN   = 64;
+const int   LAT_BINS      = 24;
+const float LAT_BIN_MS    = 0.01F; // upper edge of the first latency bin
 
 } // end namespace mips
@@ -1,8 +1,11 @@
 
 #include "h2_alsh.h"
+#include "parallel.h"
 
 namespace mips {
 
+bool g_shared_proj = false;			// global param: share lsh functions
+
 // -----------------------------------------------------------------------------
 H2_ALSH::H2_ALSH(					// constructor
 	int   n,							// number of data objects
@@ -11,7 +14,8 @@ H2_ALSH::H2_ALSH(					// constructor
 	float mip_ratio,					// approximation ratio for AMIP search
 	const float **data, 				// input data
 	const float **norm_d)				// l2-norm of data objects
-	: n_pts_(n), dim_(d), ratio_(mip_ratio), data_(data), norm_d_(norm_d)
+	: n_pts_(n), dim_(d), nn_ratio_(nn_ratio), ratio_(mip_ratio), data_(data), 
+	norm_d_(norm_d), map_(NULL), map_size_(0)
 {
 	// -------------------------------------------------------------------------
 	//  sort data objects by their Euclidean norms under the ascending order
@@ -30,15 +34,18 @@ H2_ALSH::H2_ALSH(					// constructor
 	b_ = sqrt((pow(nn_ratio,4.0f) - 1) / (pow(nn_ratio,4.0f) - mip_ratio));
 
 	// -------------------------------------------------------------------------
-	//  divide datasets into blocks and build qalsh for each block
+	//  divide datasets into blocks and create qalsh for each large block. the 
+	//  hash functions are drawn here in block order, so that the index does 
+	//  not depend on the number of threads
 	// -------------------------------------------------------------------------
-	float *h2_alsh_data = new float[d + 1];
-	int   start = 0;
+	proj_m_ = 0; proj_ = NULL;
+	int start = 0;
+	int max_cnt = 0, max_m = 0;		// size of working space of qalsh
 
 	while (start < n) {
 		// divide one block
 		float M = order[start].key_;
-		float min_radius = M * b_, M_sqr = SQR(M);
+		float min_radius = M * b_;
 		int   idx = start, cnt = 0;
 
 		while (idx < n && order[idx].key_ >= min_radius) {
@@ -46,56 +53,346 @@ H2_ALSH::H2_ALSH(					// constructor
 			if (++cnt >= MAX_BLOCK_NUM) break;
 		}
 
-		// build qalsh for this block
 		Block *block  = new Block();
 		block->n_pts_ = cnt;
 		block->M_     = M;
 		block->index_ = h2_alsh_id_ + start;
 
 		if (cnt > N_THRESHOLD) {
-			block->lsh_ = new QALSH(cnt, d + 1, nn_ratio);
-			
-			// build hash tables for qalsh
-			int m = block->lsh_->m_;
-			for (int i = 0; i < cnt; ++i) {
-				// construct new format of data by h2_alsh transformation
-				int id = block->index_[i];
-				for (int j = 0; j < d; ++j) {
-					h2_alsh_data[j] = data[id][j];
-				}
-				h2_alsh_data[d] = sqrt(M_sqr - SQR(norm_d[id][0]));
-
-				// calc hash value for new format of data
-				for (int j = 0; j < m; ++j) {
-					float val = block->lsh_->calc_hash_value(j, h2_alsh_data);
-					block->lsh_->tables_[j][i].id_  = i;
-					block->lsh_->tables_[j][i].key_ = val;
-				}
-			}
-			for (int i = 0; i < m; ++i) {
-				qsort(block->lsh_->tables_[i], cnt, sizeof(Result), ResultComp);
-			}
+			block->lsh_ = new QALSH(cnt, d + 1, nn_ratio, !g_shared_proj);
+			max_cnt = MAX(max_cnt, cnt);
+			max_m   = MAX(max_m, block->lsh_->m_);
 		}
 		blocks_.push_back(block);
 		start += cnt;
 	}
 	assert(start == n);
+	scratch_ = new QALSH_Scratch(max_cnt, max_m);
+	max_m_   = max_m;
+
+	if (g_shared_proj && max_m > 0) {
+		proj_m_ = max_m;
+		proj_   = new float*[proj_m_];
+		for (int i = 0; i < proj_m_; ++i) { // chosen from N(0.0, 1.0)
+			proj_[i] = new float[d + 1];
+			for (int j = 0; j <= d; ++j) {
+				proj_[i][j] = gaussian(0.0F, 1.0F);
+			}
+		}
+		for (auto block : blocks_) {
+			if (block->lsh_ != NULL) block->lsh_->a_ = proj_;
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//  build hash tables in parallel, block by block. the points of a block 
+	//  are first transformed once into h2_alsh_data (in parallel), and then 
+	//  a task computes the hash values of a group of tables and sorts them
+	// -------------------------------------------------------------------------
+	const int TABLE_GROUP = 8;		// number of tables per task
+	std::vector<float> h2_alsh_data((int64_t) max_cnt * (d + 1));
+	for (auto block : blocks_) {
+		QALSH *lsh  = block->lsh_;
+		if (lsh == NULL) continue;
+		int   cnt   = block->n_pts_;
+		float M_sqr = SQR(block->M_);
+
+		// construct new format of data by h2_alsh transformation
+		parallel_for(cnt, 256, [&](int /*tid*/, int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				int   id  = block->index_[i];
+				float *x  = &h2_alsh_data[(int64_t) i * (d + 1)];
+				for (int j = 0; j < d; ++j) x[j] = data[id][j];
+				x[d] = sqrt(M_sqr - SQR(norm_d[id][0]));
+			}
+		});
+
+		// calc hash values for new format of data and sort the tables
+		int num_groups = (lsh->m_ + TABLE_GROUP - 1) / TABLE_GROUP;
+		parallel_for(num_groups, 1, [&](int /*tid*/, int begin, int end) {
+			int first = begin * TABLE_GROUP;
+			int last  = MIN(end * TABLE_GROUP, lsh->m_);
+			for (int i = 0; i < cnt; ++i) {
+				const float *x = &h2_alsh_data[(int64_t) i * (d + 1)];
+				for (int j = first; j < last; ++j) {
+					lsh->tables_[j][i].id_  = i;
+					lsh->tables_[j][i].key_ = lsh->calc_hash_value(j, x);
+				}
+			}
+			for (int j = first; j < last; ++j) lsh->build_table(j);
+		});
+	}
+	for (auto block : blocks_) {
+		if (block->lsh_ != NULL) block->lsh_->build_tables();
+	}
 	
 	// -------------------------------------------------------------------------
 	//  release space
 	// -------------------------------------------------------------------------
 	delete[] order;
-	delete[] h2_alsh_data;
 }
 
 // -----------------------------------------------------------------------------
 H2_ALSH::~H2_ALSH()					// destructor
 {
-	delete[] h2_alsh_id_; h2_alsh_id_ = NULL; 	
+	if (map_ == NULL) delete[] h2_alsh_id_;
+	h2_alsh_id_ = NULL;
 	for (auto block : blocks_) {
 		delete block; block = NULL;
 	}
 	blocks_.clear(); blocks_.shrink_to_fit();
+	delete scratch_; scratch_ = NULL;
+
+	if (proj_ != NULL) {
+		for (int i = 0; i < proj_m_ && map_ == NULL; ++i) {
+			delete[] proj_[i]; proj_[i] = NULL;
+		}
+		delete[] proj_; proj_ = NULL;
+	}
+	if (map_ != NULL) { munmap(map_, map_size_); map_ = NULL; }
+}
+
+// -----------------------------------------------------------------------------
+H2_ALSH::H2_ALSH(					// constructor (empty, filled by load)
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	const float **data, 				// input data
+	const float **norm_d)				// l2-norm of data objects
+	: n_pts_(n), dim_(d), nn_ratio_(0), ratio_(0), b_(0), M_(0), data_(data),
+	norm_d_(norm_d), h2_alsh_id_(NULL), scratch_(NULL), max_m_(0), proj_m_(0),
+	proj_(NULL), map_(NULL), map_size_(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+static uint64_t data_checksum(		// checksum of data objects
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	const float **data)					// data objects (after -rd, if any)
+{
+	// the rows themselves, so that a different order of dimensions is caught
+	uint64_t ret = (uint64_t) n;
+	for (int i = 0; i < n; ++i) {
+		ret = ret * 0x9E3779B185EBCA87ULL + checksum64(data[i], 
+			(int64_t) SIZEFLOAT * d);
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::save(					// save the index to a file
+	const char *fname)					// address of index file
+{
+	// -------------------------------------------------------------------------
+	//  write into a temporary file which replaces the index file at the end, 
+	//  so that a reader never sees a partial index
+	// -------------------------------------------------------------------------
+	char tmp_name[300];
+	sprintf(tmp_name, "%s.tmp", fname);
+	FILE *fp = fopen(tmp_name, "wb+");
+	if (!fp) { printf("Could not create %s\n", tmp_name); return 1; }
+
+	H2_ALSH_Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic_, "H2_ALSH", 8);
+	h.version_    = INDEX_VERSION;
+	h.endian_     = 0x01020304;
+	h.data_       = data_checksum(n_pts_, dim_, data_);
+	h.n_          = n_pts_;
+	h.d_          = dim_;
+	h.nn_ratio_   = nn_ratio_;
+	h.ratio_      = ratio_;
+	h.b_          = b_;
+	h.M_          = M_;
+	h.num_blocks_ = (int) blocks_.size();
+	h.proj_m_     = proj_m_;
+	h.shared_     = g_shared_proj ? 1 : 0;
+	h.compact_    = g_compact_tables ? 1 : 0;
+
+	// -------------------------------------------------------------------------
+	//  h2_alsh_id_ and proj_ follow the header page, then the qalsh of each 
+	//  block, and the Block_Headers at the end
+	// -------------------------------------------------------------------------
+	std::vector<Block_Header> bh(blocks_.size());
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && 
+		write_padding(fp, INDEX_PAGE) == 0;
+	if (ok) {
+		h.ids_ = (int64_t) ftello(fp);
+		ok = fwrite(h2_alsh_id_, SIZEINT, n_pts_, fp) == (size_t) n_pts_;
+	}
+	if (ok && proj_ != NULL) {
+		ok = write_padding(fp, INDEX_ALIGN) == 0;
+		h.proj_ = (int64_t) ftello(fp);
+		for (int i = 0; i < proj_m_ && ok; ++i) {
+			ok = fwrite(proj_[i], SIZEFLOAT, dim_ + 1, fp) == (size_t) dim_ + 1;
+		}
+	}
+	for (size_t i = 0; i < blocks_.size() && ok; ++i) {
+		Block *block = blocks_[i];
+		memset(&bh[i], 0, sizeof(Block_Header));
+		bh[i].n_pts_ = block->n_pts_;
+		bh[i].start_ = (int) (block->index_ - h2_alsh_id_);
+		bh[i].M_     = block->M_;
+		if (block->lsh_ != NULL) {
+			bh[i].lsh_ = block->lsh_->save(fp);
+			ok = bh[i].lsh_ > 0;
+		}
+	}
+	if (ok) {
+		ok = write_padding(fp, INDEX_ALIGN) == 0;
+		h.blocks_ = (int64_t) ftello(fp);
+		ok = ok && fwrite(bh.data(), sizeof(Block_Header), bh.size(), fp) == 
+			bh.size();
+	}
+	if (ok) {
+		h.size_ = (int64_t) ftello(fp);
+		ok = fseeko(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+	}
+	ok = fclose(fp) == 0 && ok;
+
+	// -------------------------------------------------------------------------
+	//  calc the checksum of all pages but the header page
+	// -------------------------------------------------------------------------
+	if (ok) {
+		int fd = open(tmp_name, O_RDWR);
+		char *addr = fd < 0 ? (char *) MAP_FAILED : (char *) mmap(NULL, 
+			h.size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (fd >= 0) close(fd);
+		ok = addr != MAP_FAILED;
+		if (ok) {
+			((H2_ALSH_Header *) addr)->checksum_ = checksum64(
+				addr + INDEX_PAGE, h.size_ - INDEX_PAGE);
+			ok = msync(addr, h.size_, MS_SYNC) == 0;
+			munmap(addr, h.size_);
+		}
+	}
+	if (!ok || rename(tmp_name, fname) != 0) {
+		printf("Could not write %s\n", fname);
+		remove(tmp_name);
+		return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::load(					// load an index from a file
+	const char *fname,					// address of index file
+	int   n,							// number of data objects
+	int   d,							// dimension of data objects
+	float nn_ratio,						// approximation ratio for NN
+	float mip_ratio,					// approximation ratio for MIP
+	const float **data, 				// input data
+	const float **norm_d,				// l2-norm of data objects
+	H2_ALSH **lsh)						// index (return)
+{
+	*lsh = NULL;
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) { printf("Could not open %s\n", fname); return 1; }
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < INDEX_PAGE) {
+		printf("%s is not an index of H2_ALSH\n", fname);
+		close(fd);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  map the file read-only, pages are shared with the page cache
+	// -------------------------------------------------------------------------
+	int64_t size = (int64_t) st.st_size;
+	char *addr = (char *) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) { printf("Could not mmap %s\n", fname); return 1; }
+
+	// -------------------------------------------------------------------------
+	//  check the header, the parameters, the data, and the checksum
+	// -------------------------------------------------------------------------
+	const H2_ALSH_Header *h = (const H2_ALSH_Header *) addr;
+	const char *error = NULL;
+	auto within = [&](int64_t offset, int64_t bytes) {
+		return offset >= INDEX_PAGE && bytes >= 0 && offset + bytes <= size;
+	};
+	if (memcmp(h->magic_, "H2_ALSH", 8) != 0) {
+		error = "is not an index of H2_ALSH";
+	}
+	else if (h->version_ != INDEX_VERSION || h->endian_ != 0x01020304) {
+		error = "has another version or byte order";
+	}
+	else if (h->size_ != size) {
+		error = "is truncated";
+	}
+	else if (h->n_ != n || h->d_ != d || h->nn_ratio_ != nn_ratio || 
+		h->ratio_ != mip_ratio || h->shared_ != (int) g_shared_proj || 
+		h->compact_ != (int) g_compact_tables) {
+		error = "was built with other parameters";
+	}
+	else if (!within(h->ids_, (int64_t) SIZEINT * n) || 
+		!within(h->blocks_, (int64_t) sizeof(Block_Header) * h->num_blocks_) ||
+		(h->proj_m_ > 0 && !within(h->proj_, 
+			(int64_t) SIZEFLOAT * h->proj_m_ * (d + 1)))) {
+		error = "is corrupted";
+	}
+	else if (h->data_ != data_checksum(n, d, data)) {
+		error = "was built for another data set";
+	}
+	else if (h->checksum_ != checksum64(addr + INDEX_PAGE, size - INDEX_PAGE)) {
+		error = "is corrupted (checksum mismatch)";
+	}
+	if (error != NULL) {
+		printf("%s %s\n", fname, error);
+		munmap(addr, size);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  restore the index in place
+	// -------------------------------------------------------------------------
+	H2_ALSH *ret = new H2_ALSH(n, d, data, norm_d);
+	ret->nn_ratio_   = h->nn_ratio_;
+	ret->ratio_      = h->ratio_;
+	ret->b_          = h->b_;
+	ret->M_          = h->M_;
+	ret->map_        = addr;
+	ret->map_size_   = size;
+	ret->h2_alsh_id_ = (int *) (addr + h->ids_);
+	if (h->proj_m_ > 0) {
+		ret->proj_m_ = h->proj_m_;
+		ret->proj_   = new float*[h->proj_m_];
+		for (int i = 0; i < h->proj_m_; ++i) {
+			ret->proj_[i] = (float *) (addr + h->proj_) + (int64_t) i * (d + 1);
+		}
+	}
+
+	const Block_Header *bh = (const Block_Header *) (addr + h->blocks_);
+	int max_cnt = 0, max_m = 0;
+	for (int i = 0; i < h->num_blocks_; ++i) {
+		Block *block  = new Block();
+		block->n_pts_ = bh[i].n_pts_;
+		block->M_     = bh[i].M_;
+		block->index_ = ret->h2_alsh_id_ + bh[i].start_;
+		ret->blocks_.push_back(block);
+
+		if (bh[i].start_ < 0 || bh[i].n_pts_ < 0 || 
+			bh[i].start_ + bh[i].n_pts_ > n) { error = "is corrupted"; break; }
+		if (bh[i].lsh_ == 0) continue;
+
+		if (!within(bh[i].lsh_, sizeof(QALSH_Header))) {
+			error = "is corrupted"; break;
+		}
+		block->lsh_ = new QALSH(addr, bh[i].lsh_);
+		if (!block->lsh_->own_a_) block->lsh_->a_ = ret->proj_;
+		max_cnt = MAX(max_cnt, block->n_pts_);
+		max_m   = MAX(max_m, block->lsh_->m_);
+	}
+	ret->scratch_ = new QALSH_Scratch(max_cnt, max_m);
+	ret->max_m_   = max_m;
+	if (error != NULL) {
+		printf("%s %s\n", fname, error);
+		delete ret;
+		return 1;
+	}
+	*lsh = ret;
+	return 0;
 }
 
 // -------------------------------------------------------------------------
@@ -106,7 +403,8 @@ void H2_ALSH::display()				// display parameters
 	printf("    d          = %d\n",   dim_);
 	printf("    c          = %.1f\n", ratio_);
 	printf("    M          = %f\n",   M_);
-	printf("    num_blocks = %d\n\n", (int) blocks_.size());
+	printf("    num_blocks = %d\n",   (int) blocks_.size());
+	printf("    shared     = %d\n\n", (int) (proj_ != NULL));
 }
 
 // -----------------------------------------------------------------------------
@@ -114,7 +412,8 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
-	MaxK_List *list)					// top-k MIP results (return)  
+	MaxK_List *list,					// top-k MIP results (return)
+	QALSH_Scratch *scratch)			// working space (NULL: own one)
 {
 	// -------------------------------------------------------------------------
 	//  initialize parameters
@@ -122,8 +421,12 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 	float kip   = MINREAL;
 	float normq = norm_q[0];
 	float *h2_alsh_query = new float[dim_ + 1];
+	float *q_proj = NULL;			// projection of query by proj_
+	QALSH_Scratch *work = acquire_scratch(scratch, scratch_);
 	std::vector<int> cand;
 
+	STATS_ADD(blocks_total_, blocks_.size());
+
 	// -------------------------------------------------------------------------
 	//  c-k-AMIP search
 	// -------------------------------------------------------------------------
@@ -132,11 +435,14 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 		int   n      = block->n_pts_;
 		float M      = block->M_;
 		if (M * normq <= kip) break;
+		STATS_ADD(blocks_visited_, 1);
 
 		if (n <= N_THRESHOLD) {
 			// -----------------------------------------------------------------
 			//  MIP search by linear scan
 			// -----------------------------------------------------------------
+			STATS_ADD(blocks_linear_, 1);
+			STATS_START(t_linear);
 			for (int j = 0; j < n; ++j) {
 				int id = index[j];
 				if (norm_d_[id][0] * normq <= kip) break;
@@ -145,24 +451,47 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 					norm_d_[id], query, norm_q);
 				kip = list->insert(ip, id + 1);
 			}
+			STATS_STOP(t_linear_, t_linear);
 		}
 		else {
 			// -----------------------------------------------------------------
 			//  conduct c-k-ANN search by qalsh
 			// -----------------------------------------------------------------
+			QALSH *lsh   = block->lsh_;
 			float lambda = M / normq;
 			float R = sqrt(2.0f * (M * M - lambda * kip));
-			for (int j = 0; j < dim_; ++j) {
-				h2_alsh_query[j] = lambda * query[j];
-			}
-			h2_alsh_query[dim_] = 0.0f;
 
 			cand.clear();
-			block->lsh_->knn(top_k, R, (const float *) h2_alsh_query, cand);
+			if (proj_ == NULL) {
+				for (int j = 0; j < dim_; ++j) {
+					h2_alsh_query[j] = lambda * query[j];
+				}
+				h2_alsh_query[dim_] = 0.0f;
+				lsh->knn(top_k, R, (const float *) h2_alsh_query, cand, 
+					work);
+			}
+			else {
+				if (q_proj == NULL) {	// project query once for all blocks
+					STATS_START(t_project);
+					q_proj = new float[proj_m_];
+					for (int j = 0; j < proj_m_; ++j) {
+						q_proj[j] = calc_inner_product(dim_, 
+							(const float *) proj_[j], query);
+					}
+					STATS_STOP(t_project_, t_project);
+				}
+				work->reserve(lsh->n_, lsh->m_);
+				float *q_val = work->q_val_;
+				for (int j = 0; j < lsh->m_; ++j) {
+					q_val[j] = lambda * q_proj[j];
+				}
+				lsh->knn_by_hash(top_k, R, (const float *) q_val, cand, work);
+			}
 
 			// -----------------------------------------------------------------
 			//  compute inner product for the candidates returned by qalsh
 			// -----------------------------------------------------------------
+			STATS_START(t_verify);
 			int size = (int) cand.size();
 			for (int j = 0; j < size; ++j) {
 				int id = index[cand[j]];
@@ -173,9 +502,172 @@ int H2_ALSH::kmip(					// c-k-AMIP search
 					kip = list->insert(ip, id + 1);
 				}
 			}
+			STATS_STOP(t_verify_, t_verify);
 		}
 	}
 	delete[] h2_alsh_query; h2_alsh_query = NULL;
+	if (q_proj != NULL) { delete[] q_proj; q_proj = NULL; }
+	release_scratch(work, scratch, scratch_);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+static void project_batch(			// project a batch of queries
+	int   m,							// number of projections
+	int   d,							// dimensionality
+	const float **a,					// projections (m rows of >= d floats)
+	int   num,							// number of queries
+	const int *qid,						// ids of queries
+	const float **query,				// queries
+	int   ldp,							// row stride of proj
+	float *proj)						// projections of query qid[i] (return)
+{
+	// -------------------------------------------------------------------------
+	//  one matrix product per tile of queries by the block kernel, whose rows 
+	//  (m inner products of a query) are then copied into proj
+	// -------------------------------------------------------------------------
+	const int QUERY_TILE = 16;		// number of queries per tile
+	const float *qs[QUERY_TILE];
+	std::vector<float> block((int64_t) QUERY_TILE * m);
+	for (int start = 0; start < num; start += QUERY_TILE) {
+		int cnt = MIN(QUERY_TILE, num - start);
+		for (int i = 0; i < cnt; ++i) qs[i] = query[qid[start + i]];
+
+		g_ip.ip_block_(d, cnt, qs, m, a, &block[0]);
+		for (int i = 0; i < cnt; ++i) {
+			memcpy(proj + (int64_t) (start + i) * ldp, &block[(int64_t) i * m],
+				SIZEFLOAT * m);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+int H2_ALSH::kmip_batch(			// k-MIP search for a batch of queries
+	int   qn,							// number of queries
+	int   top_k,						// top-k value
+	const float **query,				// input queries
+	const float **norm_q,				// l2-norms of queries
+	MaxK_List **list,					// top-k MIP results of each query (return)
+	QALSH_Scratch *scratch)				// working space (NULL: own one)
+{
+	// -------------------------------------------------------------------------
+	//  initialize parameters
+	// -------------------------------------------------------------------------
+	QALSH_Scratch *work = acquire_scratch(scratch, scratch_);
+	int   ldp    = MAX(max_m_, 1);	// row stride of proj
+	float *kip   = new float[qn];
+	int   *qid   = new int[qn];		// ids of active queries
+	int   *pos   = new int[qn];		// rows of qid[i] in proj
+	float *proj  = new float[(int64_t) qn * ldp];
+	std::vector<int> cand;
+
+	int num = 0;
+	for (int i = 0; i < qn; ++i) {
+		kip[i] = MINREAL; qid[num] = i; pos[num] = i; ++num;
+	}
+	STATS_ADD(blocks_total_, (int64_t) qn * blocks_.size());
+	if (proj_ != NULL) {			// project all queries once
+		STATS_START(t_project);
+		project_batch(proj_m_, dim_, (const float **) proj_, qn, qid, query, 
+			ldp, proj);
+		STATS_STOP(t_project_, t_project);
+	}
+
+	// -------------------------------------------------------------------------
+	//  c-k-AMIP search, block by block
+	// -------------------------------------------------------------------------
+	for (auto block : blocks_) {
+		int   *index = block->index_;
+		int   n      = block->n_pts_;
+		float M      = block->M_;
+		QALSH *lsh   = block->lsh_;
+
+		// drop the queries whose bound is met (blocks are in desc order of M)
+		int cnt = 0;
+		for (int i = 0; i < num; ++i) {
+			if (M * norm_q[qid[i]][0] > kip[qid[i]]) {
+				qid[cnt] = qid[i]; pos[cnt] = pos[i]; ++cnt;
+			}
+		}
+		num = cnt;
+		if (num == 0) break;
+		STATS_ADD(blocks_visited_, num);
+
+		if (lsh != NULL && proj_ == NULL) {
+			// the last coordinate of queries after transformation is 0
+			STATS_START(t_project);
+			project_batch(lsh->m_, dim_, (const float **) lsh->a_, num, qid,
+				query, ldp, proj);
+			for (int i = 0; i < num; ++i) pos[i] = i;
+			STATS_STOP(t_project_, t_project);
+		}
+
+		for (int i = 0; i < num; ++i) {
+			int   q     = qid[i];
+			float normq = norm_q[q][0];
+			float k_ip  = kip[q];
+
+			if (lsh == NULL) {
+				// -------------------------------------------------------------
+				//  MIP search by linear scan
+				// -------------------------------------------------------------
+				STATS_ADD(blocks_linear_, 1);
+				STATS_START(t_linear);
+				for (int j = 0; j < n; ++j) {
+					int id = index[j];
+					if (norm_d_[id][0] * normq <= k_ip) break;
+					
+					float ip = calc_inner_product(dim_, k_ip, data_[id], 
+						norm_d_[id], query[q], norm_q[q]);
+					k_ip = list[q]->insert(ip, id + 1);
+				}
+				STATS_STOP(t_linear_, t_linear);
+			}
+			else {
+				// -------------------------------------------------------------
+				//  conduct c-k-ANN search by qalsh
+				// -------------------------------------------------------------
+				float lambda = M / normq;
+				float R = sqrt(2.0f * (M * M - lambda * k_ip));
+
+				work->reserve(lsh->n_, lsh->m_);
+				const float *q_proj = proj + (int64_t) pos[i] * ldp;
+				float *q_val = work->q_val_;
+				for (int j = 0; j < lsh->m_; ++j) {
+					q_val[j] = lambda * q_proj[j];
+				}
+				cand.clear();
+				lsh->knn_by_hash(top_k, R, (const float *) q_val, cand, work);
+
+				// -------------------------------------------------------------
+				//  compute inner product for the candidates returned by qalsh
+				// -------------------------------------------------------------
+				STATS_START(t_verify);
+				int size = (int) cand.size();
+				for (int j = 0; j < size; ++j) {
+					int id = index[cand[j]];
+
+					if (norm_d_[id][0] * normq > k_ip) {
+						float ip = calc_inner_product(dim_, k_ip, data_[id], 
+							norm_d_[id], query[q], norm_q[q]);
+						k_ip = list[q]->insert(ip, id + 1);
+					}
+				}
+				STATS_STOP(t_verify_, t_verify);
+			}
+			kip[q] = k_ip;
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	delete[] kip;  kip  = NULL;
+	delete[] qid;  qid  = NULL;
+	delete[] pos;  pos  = NULL;
+	delete[] proj; proj = NULL;
+	release_scratch(work, scratch, scratch_);
 
 	return 0;
 }
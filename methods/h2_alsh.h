@@ -26,10 +26,65 @@ struct Block {
 	~Block() { if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; } }
 };
 
+extern bool g_shared_proj;			// global param: share lsh functions
+
+// -----------------------------------------------------------------------------
+//  H2_ALSH_Header: the first page of an index file of H2_ALSH. the rest of 
+//  the file holds h2_alsh_id_, proj_, the Block_Headers, and the qalsh of 
+//  each block on its own pages (see QALSH_Header). offsets are relative to 
+//  the start of the file, and all numbers are in native byte order.
+// -----------------------------------------------------------------------------
+struct H2_ALSH_Header {
+	char     magic_[8];				// "H2_ALSH"
+	uint32_t version_;				// INDEX_VERSION
+	uint32_t endian_;				// 0x01020304 in native byte order
+	int64_t  size_;					// size of file (bytes)
+	uint64_t checksum_;				// checksum64 of [INDEX_PAGE, size_)
+	uint64_t data_;					// checksum of the data objects
+	int32_t  n_;					// number of data objects
+	int32_t  d_;					// dimension of data objects
+	float    nn_ratio_;				// approximation ratio for NN
+	float    ratio_;				// approximation ratio for MIP
+	float    b_;					// compression ratio
+	float    M_;					// max norm of the data objects
+	int32_t  num_blocks_;			// number of blocks
+	int32_t  proj_m_;				// number of rows of proj_ (0: per block)
+	int32_t  shared_;				// g_shared_proj of the index
+	int32_t  compact_;				// g_compact_tables of the index
+	int64_t  ids_;					// offset of h2_alsh_id_ (n_ ints)
+	int64_t  proj_;					// offset of proj_ (proj_m_ x (d_+1))
+	int64_t  blocks_;				// offset of Block_Headers
+};
+
+struct Block_Header {
+	int32_t  n_pts_;				// number of data objects
+	int32_t  start_;				// position of index_ in h2_alsh_id_
+	float    M_;					// max norm of the block
+	int32_t  reserved_;				// reserved (0)
+	int64_t  lsh_;					// offset of QALSH_Header (0: no qalsh)
+};
+
 // -----------------------------------------------------------------------------
 //  Asymmetric Locality-Sensitive Hashing based on Homocentric Hypersphere 
 //  partition (H2_ALSH) is used to solve the problem of c-Approximate Maximum 
 //  Inner Product (c-AMIP) search
+//
+//  with g_shared_proj, the qalsh of all blocks share one projection matrix 
+//  proj_ sized for the largest block. since the last coordinate of a query 
+//  after h2_alsh transformation is 0 and the projection is linear, a query is 
+//  projected once per kmip and the hash values of a block are those scaled by 
+//  its lambda.
+//
+//  kmip_batch walks the blocks once for a batch of queries: the queries still 
+//  active at a block (M * |q| > kip) are projected together by its matrix (or
+//  by proj_ once per batch) and searched in turn, and a query is dropped as 
+//  soon as its bound is met.
+//
+//  save writes a built index to a file, and load maps such a file read-only 
+//  instead of building the index: the ids, the lsh functions, and the sorted 
+//  tables are used in place, so loading costs about one pass over the file 
+//  (to verify its checksum) rather than the projections and sorts of all 
+//  blocks.
 // -----------------------------------------------------------------------------
 class H2_ALSH {
 public:
@@ -44,6 +99,21 @@ public:
 	// -------------------------------------------------------------------------
 	~H2_ALSH();						// destructor
 
+	// -------------------------------------------------------------------------
+	static int load(				// load an index from a file
+		const char *fname,				// address of index file
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		float nn_ratio,					// approximation ratio for NN
+		float mip_ratio,				// approximation ratio for MIP
+		const float **data, 			// input data
+		const float **norm_d,			// l2-norm of data objects
+		H2_ALSH **lsh);					// index (return)
+
+	// -------------------------------------------------------------------------
+	int save(						// save the index to a file
+		const char *fname);				// address of index file
+
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
@@ -52,7 +122,17 @@ public:
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
-		MaxK_List *list);				// top-k MIP results (return) 
+		MaxK_List *list,				// top-k MIP results (return)
+		QALSH_Scratch *scratch = NULL); // working space (NULL: own one)
+
+	// -------------------------------------------------------------------------
+	int kmip_batch(					// k-MIP search for a batch of queries
+		int   qn,						// number of queries
+		int   top_k,					// top-k value
+		const float **query,			// input queries
+		const float **norm_q,			// l2-norms of queries
+		MaxK_List **list,				// top-k MIP results of each query (return)
+		QALSH_Scratch *scratch = NULL); // working space (NULL: own one)
 
 	// -------------------------------------------------------------------------
 	int64_t get_memory_usage()		// get memory usage
@@ -64,12 +144,15 @@ public:
 			ret += sizeof(*block);
 			if (block->lsh_ != NULL) ret += block->lsh_->get_memory_usage();
 		}
+		ret += scratch_->get_memory_usage();
+		if (proj_ != NULL) ret += SIZEFLOAT * proj_m_ * (dim_ + 1);
 		return ret;
 	}
 
 protected:
 	int   n_pts_;					// number of data objects
 	int   dim_;						// dimension of data objects
+	float nn_ratio_;				// approximation ratio for NN
 	float ratio_;					// approximation ratio for MIP
 	float b_;						// compression ratio
 	float M_;						// max norm of the data objects
@@ -78,6 +161,19 @@ protected:
 	
 	int *h2_alsh_id_;				// data id after h2_alsh transformation
 	std::vector<Block*> blocks_;	// blocks
+	QALSH_Scratch *scratch_;		// working space of qalsh for all blocks
+	int   max_m_;					// max number of hash tables of blocks
+	int   proj_m_;					// number of rows of proj_
+	float **proj_;					// shared lsh functions (NULL: per block)
+	char  *map_;					// mapped index file (NULL: built)
+	int64_t map_size_;				// size of map_
+
+	// -------------------------------------------------------------------------
+	H2_ALSH(						// constructor (empty, filled by load)
+		int   n,						// number of data objects
+		int   d,						// dimension of data objects
+		const float **data, 			// input data
+		const float **norm_d);			// l2-norm of data objects
 };
 
 } // end namespace mips
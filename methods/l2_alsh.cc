@@ -19,6 +19,7 @@ L2_ALSH::L2_ALSH(					// constructor
 	int l2_alsh_dim = d + m;
 	lsh_ = new QALSH(n, l2_alsh_dim, nn_ratio);
 	lsh_->display();
+	scratch_ = new QALSH_Scratch(n, lsh_->m_);
 	
 	// -------------------------------------------------------------------------
 	//  calculate the Euclidean norm of data and find the maximum norm
@@ -56,9 +57,7 @@ L2_ALSH::L2_ALSH(					// constructor
 			lsh_->tables_[j][i].key_ = lsh_->calc_hash_value(j, l2_alsh_data);
 		}
 	}
-	for (int i = 0; i < lsh_m; ++i) {
-		qsort(lsh_->tables_[i], n, sizeof(Result), ResultComp);
-	}
+	lsh_->build_tables();
 	// -------------------------------------------------------------------------
 	//  release space
 	// -------------------------------------------------------------------------
@@ -70,6 +69,7 @@ L2_ALSH::L2_ALSH(					// constructor
 L2_ALSH::~L2_ALSH()					// destructor
 {
 	if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; }
+	if (scratch_ != NULL) { delete scratch_; scratch_ = NULL; }
 }
 
 // -----------------------------------------------------------------------------
@@ -89,7 +89,8 @@ int L2_ALSH::kmip(					// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
-	MaxK_List *list)					// top-k MIP results (return) 
+	MaxK_List *list,					// top-k MIP results (return)
+	QALSH_Scratch *scratch)			// working space (NULL: own one)
 {
 	// -------------------------------------------------------------------------
 	//  construct L2_ALSH query
@@ -107,7 +108,9 @@ int L2_ALSH::kmip(					// c-k-AMIP search
 	//  conduct c-k-ANN search by qalsh
 	// -------------------------------------------------------------------------
 	std::vector<int> cand;
-	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh_query, cand);
+	QALSH_Scratch *work = acquire_scratch(scratch, scratch_);
+	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh_query, cand, work);
+	release_scratch(work, scratch, scratch_);
 
 	// -------------------------------------------------------------------------
 	//  compute inner product for candidates returned by qalsh
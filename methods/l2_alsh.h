@@ -47,7 +47,8 @@ public:
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
-		MaxK_List *list);				// top-k MIP results (return) 
+		MaxK_List *list,				// top-k MIP results (return)
+		QALSH_Scratch *scratch = NULL); // working space (NULL: own one)
 	
 	// -------------------------------------------------------------------------
 	int64_t get_memory_usage()		// get memory usage
@@ -55,6 +56,7 @@ public:
 		int64_t ret = 0;
 		ret += sizeof(*this);
 		ret += lsh_->get_memory_usage();
+		ret += scratch_->get_memory_usage();
 		return ret;
 	}
 
@@ -67,6 +69,7 @@ protected:
 	const float **data_;			// original data objects
 	const float **norm_d_;			// l2-norm of data objects
 	QALSH *lsh_;					// qalsh
+	QALSH_Scratch *scratch_;		// working space of qalsh
 };
 
 } // end namespace mips
@@ -21,6 +21,7 @@ L2_ALSH2::L2_ALSH2(					// constructor
 	int l2_alsh2_dim = d + 2 * m;
 	lsh_ = new QALSH(n, l2_alsh2_dim, nn_ratio); 
 	lsh_->display();
+	scratch_ = new QALSH_Scratch(n, lsh_->m_);
 	
 	// -------------------------------------------------------------------------
 	//  calculate the Euclidean norm of data and find the maximum norm of 
@@ -66,9 +67,7 @@ L2_ALSH2::L2_ALSH2(					// constructor
 			lsh_->tables_[j][i].key_ = lsh_->calc_hash_value(j, l2_alsh2_data);
 		}
 	}
-	for (int i = 0; i < lsh_m; ++i) {
-		qsort(lsh_->tables_[i], n, sizeof(Result), ResultComp);
-	}
+	lsh_->build_tables();
 
 	// -------------------------------------------------------------------------
 	//  release space
@@ -81,6 +80,7 @@ L2_ALSH2::L2_ALSH2(					// constructor
 L2_ALSH2::~L2_ALSH2()				// destructor
 {
 	if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; }
+	if (scratch_ != NULL) { delete scratch_; scratch_ = NULL; }
 }
 
 // -----------------------------------------------------------------------------
@@ -100,7 +100,8 @@ int L2_ALSH2::kmip(					// c-k-AMIP search
 	int   top_k,						// top-k value
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
-	MaxK_List *list)					// top-k MIP results (return) 
+	MaxK_List *list,					// top-k MIP results (return)
+	QALSH_Scratch *scratch)			// working space (NULL: own one)
 {
 	// -------------------------------------------------------------------------
 	//  construct L2_ALSH2 query
@@ -129,7 +130,9 @@ int L2_ALSH2::kmip(					// c-k-AMIP search
 	//  conduct c-k-ANN search by qalsh
 	// -------------------------------------------------------------------------
 	std::vector<int> cand;
-	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh2_query, cand);
+	QALSH_Scratch *work = acquire_scratch(scratch, scratch_);
+	lsh_->knn(top_k, MAXREAL, (const float *) l2_alsh2_query, cand, work);
+	release_scratch(work, scratch, scratch_);
 
 	// -------------------------------------------------------------------------
 	//  calc inner product for candidates returned by qalsh
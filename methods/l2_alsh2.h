@@ -57,7 +57,8 @@ public:
 		int   top_k,					// top-k value
 		const float *query,				// input query
 		const float *norm_q,			// l2-norm of query
-		MaxK_List *list);				// top-k MIP results (return) 
+		MaxK_List *list,				// top-k MIP results (return)
+		QALSH_Scratch *scratch = NULL); // working space (NULL: own one)
 	
 	// -------------------------------------------------------------------------
 	int64_t get_memory_usage()		// get memory usage
@@ -65,6 +66,7 @@ public:
 		int64_t ret = 0;
 		ret += sizeof(*this);
 		ret += lsh_->get_memory_usage();
+		ret += scratch_->get_memory_usage();
 		return ret;
 	}
 
@@ -78,6 +80,7 @@ protected:
 	const float **norm_d_;			// l2-norm of data objects
 	const float **norm_q_;			// l2-norm of query objects
 	QALSH *lsh_;					// qalsh
+	QALSH_Scratch *scratch_;		// working space of qalsh
 };
 
 } // end namespace mips
@@ -0,0 +1,125 @@
+#include "linear_scan.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+Linear_Scan::Linear_Scan(			// constructor
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	const float **data,					// data objects
+	const float **norm_d)				// l2-norms of data objects
+	: n_pts_(n), dim_(d)
+{
+	// -------------------------------------------------------------------------
+	//  sort data objects in descending order of l2-norms
+	// -------------------------------------------------------------------------
+	Result *order = new Result[n];
+	for (int i = 0; i < n; ++i) {
+		order[i].id_  = i;
+		order[i].key_ = norm_d[i][0];
+	}
+	qsort(order, n, sizeof(Result), ResultCompDesc);
+
+	// -------------------------------------------------------------------------
+	//  copy them in this order into 64-byte aligned rows
+	// -------------------------------------------------------------------------
+	int align = 64 / SIZEFLOAT;
+	stride_ = (d + align - 1) / align * align;
+	tile_   = MAX(16, LS_TILE_BYTES / (SIZEFLOAT * MAX(stride_, 1)) / 4 * 4);
+
+	int64_t bytes = SIZEFLOAT * (int64_t) n * stride_;
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, 64, MAX(bytes, (int64_t) 64)) != 0) {
+		printf("Could not allocate %lld bytes\n", (long long) bytes);
+		exit(1);
+	}
+	data_  = (float *) ptr;
+	rows_  = new const float*[n];
+	norm_  = new float[n];
+	index_ = new int[n];
+	for (int i = 0; i < n; ++i) {
+		float *row = data_ + (int64_t) i * stride_;
+		memcpy(row, data[order[i].id_], SIZEFLOAT * d);
+		memset(row + d, 0, SIZEFLOAT * (stride_ - d));
+
+		rows_[i]  = row;
+		norm_[i]  = order[i].key_;
+		index_[i] = order[i].id_;
+	}
+	delete[] order; order = NULL;
+}
+
+// -----------------------------------------------------------------------------
+Linear_Scan::~Linear_Scan()			// destructor
+{
+	free(data_);     data_  = NULL;
+	delete[] rows_;  rows_  = NULL;
+	delete[] norm_;  norm_  = NULL;
+	delete[] index_; index_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void Linear_Scan::display()			// display parameters
+{
+	printf("Parameters of Linear_Scan:\n");
+	printf("    n    = %d\n", n_pts_);
+	printf("    d    = %d\n", dim_);
+	printf("    tile = %d\n", tile_);
+	printf("\n");
+}
+
+// -----------------------------------------------------------------------------
+int Linear_Scan::kmip(				// k-MIP search
+	int   top_k,						// top-k value
+	const float *query,					// input query
+	const float *norm_q,				// l2-norm of query
+	MaxK_List *list)					// top-k MIP results (return)
+{
+	return kmip_batch(1, top_k, &query, &norm_q, &list);
+}
+
+// -----------------------------------------------------------------------------
+int Linear_Scan::kmip_batch(		// k-MIP search for a batch of queries
+	int   qn,							// number of queries
+	int   /*top_k*/,					// top-k value (k of each list)
+	const float **query,				// input queries
+	const float **norm_q,				// l2-norms of queries
+	MaxK_List **list)					// top-k MIP results of each query (return)
+{
+	std::vector<float> kip(qn, MINREAL);
+	std::vector<int> qid(qn);		// ids of active queries
+	for (int i = 0; i < qn; ++i) qid[i] = i;
+
+	int   tile_q = MIN(qn, LS_QUERY_TILE);
+	std::vector<const float*> qs(tile_q);
+	std::vector<float> block((int64_t) tile_q * tile_);
+
+	int num = qn;
+	for (int start = 0; start < n_pts_; start += tile_) {
+		// retire the queries whose bound is met (tiles in desc order of norms)
+		int cnt = 0;
+		for (int i = 0; i < num; ++i) {
+			int q = qid[i];
+			if (norm_[start] * norm_q[q][0] > kip[q]) qid[cnt++] = q;
+		}
+		num = cnt;
+		if (num == 0) break;
+
+		// multiply the tile with the active queries, LS_QUERY_TILE at a time
+		int size = MIN(tile_, n_pts_ - start);
+		for (int base = 0; base < num; base += tile_q) {
+			int m = MIN(tile_q, num - base);
+			for (int i = 0; i < m; ++i) qs[i] = query[qid[base + i]];
+			g_ip.ip_block_(dim_, m, &qs[0], size, rows_ + start, &block[0]);
+
+			for (int i = 0; i < m; ++i) {
+				int q = qid[base + i];
+				kip[q] = list[q]->insert_block(size, &block[(int64_t) i * size],
+					index_ + start, 1);
+			}
+		}
+	}
+	return 0;
+}
+
+} // end namespace mips
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "def.h"
+#include "util.h"
+#include "simd.h"
+#include "pri_queue.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  Linear_Scan: exact k-MIP search, the correctness baseline of all methods.
+//
+//  the data objects are copied into one aligned array in descending order 
+//  of their l2-norms. a batch of queries is answered tile by tile: each tile 
+//  of data (about LS_TILE_BYTES) is multiplied with up to LS_QUERY_TILE 
+//  queries by the block kernel while it stays in cache, and a query retires 
+//  as soon as the norm of the next tile times its own norm (Cauchy-Schwarz) 
+//  cannot exceed its k-th inner product.
+// -----------------------------------------------------------------------------
+class Linear_Scan {
+public:
+	Linear_Scan(					// constructor
+		int   n,						// number of data objects
+		int   d,						// dimensionality
+		const float **data,				// data objects
+		const float **norm_d);			// l2-norms of data objects
+
+	// -------------------------------------------------------------------------
+	~Linear_Scan();					// destructor
+
+	// -------------------------------------------------------------------------
+	void display();					// display parameters
+
+	// -------------------------------------------------------------------------
+	int kmip(						// k-MIP search
+		int   top_k,					// top-k value
+		const float *query,				// input query
+		const float *norm_q,			// l2-norm of query
+		MaxK_List *list);				// top-k MIP results (return)
+
+	// -------------------------------------------------------------------------
+	int kmip_batch(					// k-MIP search for a batch of queries
+		int   qn,						// number of queries
+		int   top_k,					// top-k value
+		const float **query,			// input queries
+		const float **norm_q,			// l2-norms of queries
+		MaxK_List **list);				// top-k MIP results of each query (return)
+
+	// -------------------------------------------------------------------------
+	int64_t get_memory_usage()		// get memory usage
+	{
+		int64_t ret = 0;
+		ret += sizeof(*this);
+		ret += SIZEFLOAT * (int64_t) n_pts_ * stride_; // for data_
+		ret += sizeof(float*) * (int64_t) n_pts_; // for rows_
+		ret += (SIZEFLOAT + SIZEINT) * (int64_t) n_pts_; // for norm_ and index_
+		return ret;
+	}
+
+protected:
+	int   n_pts_;					// number of data objects
+	int   dim_;						// dimensionality
+	int   stride_;					// floats per row of data_ (aligned)
+	int   tile_;					// number of rows per tile
+	float *data_;					// data objects in desc order of norms
+	const float **rows_;			// rows of data_
+	float *norm_;					// l2-norms of rows (descending)
+	int   *index_;					// object ids of rows
+};
+
+} // end namespace mips
@@ -4,6 +4,11 @@
 
 #include "def.h"
 #include "util.h"
+#include "dataset.h"
+#include "simd.h"
+#include "qalsh.h"
+#include "srp_lsh.h"
+#include "h2_alsh.h"
 #include "amips.h"
 #include "pre_recall.h"
 
@@ -16,59 +21,89 @@ void usage() 						// display the usage of this package
 		"-------------------------------------------------------------------\n"
 		" Usage of the package for c-Approximate MIP (c-AMIP) search\n"
 		"-------------------------------------------------------------------\n"
-		"    -alg  {integer}  options of algorithms (0 - 11)\n"
+		"    -alg  {integer}  options of algorithms (0 - 13)\n"
 		"    -n    {integer}  cardinality of the dataset\n"
 		"    -d    {integer}  dimensionality of the dataset\n"
 		"    -qn   {integer}  number of queries\n"
+		"    -k    {string}   top-k values, e.g., 100 or 1,10,100 (default\n"
+		"                     1,2,5,10; the truth set needs max k columns)\n"
 		"    -K    {integer}  #hash tables for Sign_ALSH and Simple_LSH\n"
 		"    -m    {integer}  extra dim for L2_ALSH, L2_ALSH2, Sign_ALSH\n"
 		"    -U    {real}     range (0,1] for L2_ALSH, L2_ALSH2, Sign_ALSH\n"
 		"    -c0   {real}     approximation ratio of ANN search (c0 > 1)\n"
 		"    -c    {real}     approximation ratio of AMIP search (0 < c < 1)\n"
+		"    -bs   {integer}  batch size of queries for H2_ALSH and Linear_Scan\n"
+		"                     (default 1)\n"
 		"    -ds   {string}   address of the data  set\n"
 		"    -qs   {string}   address of the query set\n"
 		"    -ts   {string}   address of the truth set\n"
 		"    -op   {string}   output path\n"
+		"    -if   {string}   index file of H2_ALSH (load it if it matches,\n"
+		"                     otherwise build the index and save it)\n"
+		"    -hp   {integer}  use huge pages for data set (0 or 1, default 0)\n"
+		"    -mmap {integer}  map binary data and query sets (0 or 1, default 0)\n"
+		"    -simd {integer}  SIMD level for inner products (0 - Scalar, 1 - SSE,\n"
+		"                     2 - AVX2, 3 - AVX-512; default: best supported)\n"
+		"    -ps   {integer}  step of pruning checkpoints (default 8)\n"
+		"    -pn   {integer}  max #pruning checkpoints (default 2, 0 - all)\n"
+		"    -pg   {integer}  geometric checkpoints ps, 2ps, 4ps, ... (0 or 1)\n"
+		"    -rd   {integer}  reorder dims by variance, descending (0 or 1)\n"
+		"    -cq   {integer}  16-bit keys and ids of QALSH tables (0 or 1)\n"
+		"    -sp   {integer}  share lsh functions of H2_ALSH blocks (0 or 1)\n"
+		"    -mih  {integer}  multi-index hashing for SRP_LSH codes (0 or 1)\n"
+		"    -threads {integer} number of threads for queries (default 1)\n"
+		"    -perf {integer}  hardware counters of query loops (0 or 1)\n"
 		"\n"
 		"-------------------------------------------------------------------\n"
 		" The options of algorithms are:\n"
 		"-------------------------------------------------------------------\n"
 		"    0  - Ground-Truth\n"
-		"         Parameters: -alg 0 -n -qn -d -ds -qs -ts\n"
+		"         Parameters: -alg 0 -n -qn -d -k -ds -qs -ts\n"
 		"\n"
 		"    1  - MIP Search by H2_ALSH\n"
-		"         Parameters: -alg 1 -n -qn -d -c0 -c -ds -qs -ts -op\n"
+		"         Parameters: -alg 1 -n -qn -d -k -c0 -c -bs -ds -qs -ts -op\n"
+		"                     [-if]\n"
 		"\n"
 		"    2  - MIP Search by L2_ALSH\n"
-		"         Parameters: -alg 2 -n -qn -d -m -U -c0 -ds -qs -ts -op\n"
+		"         Parameters: -alg 2 -n -qn -d -k -m -U -c0 -ds -qs -ts -op\n"
 		"\n"
 		"    3  - MIP Search by L2_ALSH2\n"
-		"         Parameters: -alg 3 -n -qn -d -m -U -c0 -ds -qs -ts -op\n"
+		"         Parameters: -alg 3 -n -qn -d -k -m -U -c0 -ds -qs -ts -op\n"
 		"\n"
 		"    4  - MIP Search by XBOX and H2-ALSH-\n"
-		"         Parameters: -alg 4 -n -qn -d -c0 -ds -qs -ts -op\n"
+		"         Parameters: -alg 4 -n -qn -d -k -c0 -ds -qs -ts -op\n"
 		"\n"
 		"    5  - MIP Search by Sign_ALSH\n"
-		"         Parameters: -alg 5 -n -qn -d -K -m -U -ds -qs -ts -op\n"
+		"         Parameters: -alg 5 -n -qn -d -k -K -m -U -ds -qs -ts -op\n"
 		"\n"
 		"    6  - MIP Search by Simple_LSH\n"
-		"         Parameters: -alg 6 -n -qn -d -K -ds -qs -ts -op\n"
+		"         Parameters: -alg 6 -n -qn -d -k -K -ds -qs -ts -op\n"
 		"\n"
 		"    7  - MIP search by Linear_Scan\n"
-		"         Parameters: -alg 7 -n -qn -d -ds -qs -ts -op\n"
+		"         Parameters: -alg 7 -n -qn -d -k -bs -ds -qs -ts -op\n"
 		"\n"
 		"    8  - Precision-Recall Curve of MIP Search by H2_ALSH\n"
-		"         Parameters: -alg 8 -n -qn -d -c0 -c -ds -qs -ts -op\n"
+		"         Parameters: -alg 8 -n -qn -d -k -c0 -c -ds -qs -ts -op\n"
 		"\n"
 		"    9  - Precision-Recall Curve of MIP Search by Sign_ALSH\n"
-		"         Parameters: -alg 9 -n -qn -d -K -m -U -ds -qs -ts -op\n"
+		"         Parameters: -alg 9 -n -qn -d -k -K -m -U -ds -qs -ts -op\n"
 		"\n"
 		"    10 - Precision-Recall Curve of MIP Search by Simple_LSH\n"
-		"         Parameters: -alg 10 -n -qn -d -K -ds -qs -ts -op\n"
+		"         Parameters: -alg 10 -n -qn -d -k -K -ds -qs -ts -op\n"
 		"\n"
 		"    11 - Norm Distributiuon\n"
 		"         Parameters: -alg 11 -n -d -ds -op\n"
 		"\n"
+		"    12 - Convert fvecs/bvecs/ivecs Files to Binary Files (.ds/.q)\n"
+		"         Parameters: -alg 12 -ds -qs\n"
+		"\n"
+		"    13 - Correctness Check and Benchmark of SIMD Kernels\n"
+		"         Parameters: -alg 13 [-op]\n"
+		"\n"
+		" Data and query sets can be raw binary files or .fvecs/.bvecs/.ivecs\n"
+		" files; for the latter, -n, -qn, and -d are inferred if not given.\n"
+		" The truth set can also be an .ivecs file of (0-based) ids.\n"
+		"\n"
 		"-------------------------------------------------------------------\n"
 		" Authors: Qiang Huang (huangq2011@gmail.com)                       \n"
 		"          Guihong Ma  (maguihong@vip.qq.com)                       \n"
@@ -82,10 +117,11 @@ int main(int nargs, char **args)
 	srand(6);						// srand((unsigned) time(NULL));
 	//usage();
 
-	char   data_set[200];			// address of data set
-	char   query_set[200];			// address of query set
-	char   truth_set[200];			// address of ground truth file
-	char   out_path[200];			// output path
+	char   data_set[200]  = "";		// address of data set
+	char   query_set[200] = "";		// address of query set
+	char   truth_set[200] = "";		// address of ground truth file
+	char   out_path[200]  = "";		// output path
+	char   index_file[200] = "";		// index file of H2_ALSH
 
 	int    alg       = -1;			// which algorithm?
 	int    n         = -1;			// number of data objects
@@ -96,7 +132,16 @@ int main(int nargs, char **args)
 	float  U         = -1.0f;		// param for l2-alsh, l2-alsh2, sign-alsh
 	float  nn_ratio  = -1.0f;		// approximation ratio of ANN search
 	float  mip_ratio = -1.0f;		// approximation ratio of AMIP search
+	int    batch     = 1;			// batch size of queries (h2-alsh, scan)
+	bool   huge_page = false;		// use huge pages for data set
+	bool   use_mmap  = false;		// map data set and query set from disk
+	int    prune_step = PRUNE_STEP;	// step of pruning checkpoints
+	int    prune_num = PRUNE_NUM;	// max number of pruning checkpoints
+	bool   prune_geo = false;		// geometric pruning checkpoints
+	bool   reorder   = false;		// reorder dimensions by variance
 
+	Dataset *dset    = NULL;		// data objects and their l2-norms
+	Dataset *qset    = NULL;		// query objects and their l2-norms
 	float  **data    = NULL;		// data objects
 	float  **query   = NULL;		// query objects
 	float  **norm_d  = NULL;		// l2-norm of data  objects
@@ -111,7 +156,7 @@ int main(int nargs, char **args)
 		if (strcmp(args[cnt], "-alg") == 0) {
 			alg = atoi(args[++cnt]);
 			printf("alg       = %d\n", alg);
-			if (alg < 0 || alg > 11) {
+			if (alg < 0 || alg > 13) {
 				failed = true;
 				break;
 			}
@@ -180,6 +225,24 @@ int main(int nargs, char **args)
 				break;
 			}
 		}
+		else if (strcmp(args[cnt], "-k") == 0) {
+			if (set_topk(args[++cnt])) {
+				printf("k         = %s (invalid top-k values)\n", args[cnt]);
+				failed = true;
+				break;
+			}
+			printf("k         =");
+			for (size_t r = 0; r < g_topk.size(); ++r) printf(" %d", g_topk[r]);
+			printf("\n");
+		}
+		else if (strcmp(args[cnt], "-bs") == 0) {
+			batch = atoi(args[++cnt]);
+			printf("bs        = %d\n", batch);
+			if (batch <= 0) {
+				failed = true;
+				break;
+			}
+		}
 		else if (strcmp(args[cnt], "-ds") == 0) {
 			strncpy(data_set, args[++cnt], sizeof(data_set));
 			printf("data_set  = %s\n", data_set);
@@ -192,6 +255,10 @@ int main(int nargs, char **args)
 			strncpy(truth_set, args[++cnt], sizeof(truth_set));
 			printf("truth_set = %s\n", truth_set);
 		}
+		else if (strcmp(args[cnt], "-if") == 0) {
+			strncpy(index_file, args[++cnt], sizeof(index_file));
+			printf("index_file = %s\n", index_file);
+		}
 		else if (strcmp(args[cnt], "-op") == 0) {
 			strncpy(out_path, args[++cnt], sizeof(out_path));
 			printf("out_path  = %s\n", out_path);
@@ -203,6 +270,67 @@ int main(int nargs, char **args)
 			}
 			create_dir(out_path);
 		}
+		else if (strcmp(args[cnt], "-hp") == 0) {
+			huge_page = atoi(args[++cnt]) != 0;
+			printf("huge_page = %d\n", (int) huge_page);
+		}
+		else if (strcmp(args[cnt], "-mmap") == 0) {
+			use_mmap = atoi(args[++cnt]) != 0;
+			printf("use_mmap  = %d\n", (int) use_mmap);
+		}
+		else if (strcmp(args[cnt], "-simd") == 0) {
+			int level = atoi(args[++cnt]);
+			if (!set_simd_level(level)) {
+				printf("SIMD level %d is not supported, use %s\n", level, 
+					g_ip.name_);
+			}
+			printf("simd      = %s (hamming: %s)\n", g_ip.name_, 
+				g_hamming.name_);
+		}
+		else if (strcmp(args[cnt], "-ps") == 0) {
+			prune_step = atoi(args[++cnt]);
+			printf("ps        = %d\n", prune_step);
+			if (prune_step <= 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-pn") == 0) {
+			prune_num = atoi(args[++cnt]);
+			printf("pn        = %d\n", prune_num);
+		}
+		else if (strcmp(args[cnt], "-pg") == 0) {
+			prune_geo = atoi(args[++cnt]) != 0;
+			printf("pg        = %d\n", (int) prune_geo);
+		}
+		else if (strcmp(args[cnt], "-rd") == 0) {
+			reorder = atoi(args[++cnt]) != 0;
+			printf("rd        = %d\n", (int) reorder);
+		}
+		else if (strcmp(args[cnt], "-cq") == 0) {
+			g_compact_tables = atoi(args[++cnt]) != 0;
+			printf("cq        = %d\n", (int) g_compact_tables);
+		}
+		else if (strcmp(args[cnt], "-threads") == 0) {
+			g_query_threads = atoi(args[++cnt]);
+			printf("threads   = %d\n", g_query_threads);
+			if (g_query_threads <= 0) {
+				failed = true;
+				break;
+			}
+		}
+		else if (strcmp(args[cnt], "-perf") == 0) {
+			g_perf = atoi(args[++cnt]) != 0;
+			printf("perf      = %d\n", (int) g_perf);
+		}
+		else if (strcmp(args[cnt], "-sp") == 0) {
+			g_shared_proj = atoi(args[++cnt]) != 0;
+			printf("sp        = %d\n", (int) g_shared_proj);
+		}
+		else if (strcmp(args[cnt], "-mih") == 0) {
+			g_mih = atoi(args[++cnt]) != 0;
+			printf("mih       = %d\n", (int) g_mih);
+		}
 		else {
 			failed = true;
 			usage();
@@ -215,37 +343,89 @@ int main(int nargs, char **args)
 	// -------------------------------------------------------------------------
 	//  read data set, query set, and ground truth file
 	// -------------------------------------------------------------------------
-	data   = new float*[n];
-	norm_d = new float*[n];
-	for (int i = 0; i < n; ++i) {
-		data[i]   = new float[d];
-		norm_d[i] = new float[NORM_K];
+	if (alg == 12) {
+		// ---------------------------------------------------------------------
+		//  convert vecs files to binary files (.ds for data, .q for query)
+		// ---------------------------------------------------------------------
+		char out_set[210];
+		const char *in_sets[2]  = { data_set, query_set };
+		const char *suffixes[2] = { ".ds", ".q" };
+		for (int i = 0; i < 2; ++i) {
+			if (vecs_type(in_sets[i]) == 0) continue;
+
+			strcpy(out_set, in_sets[i]);
+			strcpy(strrchr(out_set, '.'), suffixes[i]);
+			if (convert_vecs_data(in_sets[i], out_set)) exit(1);
+		}
+		return 0;
+	}
+	if (alg == 13) {
+		return simd_benchmark(out_path);
+	}
+
+	// -------------------------------------------------------------------------
+	//  infer n, qn, and d from the headers of vecs files if not given
+	// -------------------------------------------------------------------------
+	if (vecs_type(data_set) != 0 && (n <= 0 || d <= 0)) {
+		int vn = -1, vd = -1;
+		if (get_vecs_info(data_set, &vn, &vd)) exit(1);
+		if (n <= 0) n = vn;
+		if (d <= 0) d = vd;
+		printf("n         = %d (from %s)\nd         = %d\n", n, data_set, d);
+	}
+	if (vecs_type(query_set) != 0 && qn <= 0) {
+		int vn = -1, vd = -1;
+		if (get_vecs_info(query_set, &vn, &vd)) exit(1);
+		qn = vn;
+		printf("qn        = %d (from %s)\n\n", qn, query_set);
+	}
+
+	// -------------------------------------------------------------------------
+	//  set the pruning checkpoints before the partial l2-norms are calculated
+	// -------------------------------------------------------------------------
+	set_prune_schedule(d, prune_step, prune_num, prune_geo);
+	if (prune_step != PRUNE_STEP || prune_num != PRUNE_NUM || prune_geo) {
+		printf("checkpoints =");
+		for (int t = 0; t < g_prune.num_; ++t) printf(" %d", g_prune.pos_[t]);
+		printf("\n\n");
 	}
-	if (read_bin_data(n, d, true, data_set, data, norm_d)) exit(1);
+
+	// -------------------------------------------------------------------------
+	//  read data set, query set, and ground truth file
+	// -------------------------------------------------------------------------
+	if (read_dataset(n, d, true, use_mmap, huge_page, data_set, &dset)) exit(1);
 
 	if (alg >= 0 && alg <= 10) {
-        query  = new float*[qn];
-		norm_q = new float*[qn];
-        for (int i = 0; i < qn; ++i) {
-			query[i]  = new float[d];
-			norm_q[i] = new float[NORM_K];
+		if (read_dataset(qn, d, false, use_mmap, false, query_set, &qset)) {
+			exit(1);
 		}
-        if (read_bin_data(qn, d, false, query_set, query, norm_q)) exit(1);
     }
+	if (reorder) reorder_dims(dset, qset);
+
+	data   = dset->rows_;
+	norm_d = dset->norm_rows_;
+	if (qset != NULL) {
+		query  = qset->rows_;
+		norm_q = qset->norm_rows_;
+	}
 
 	if (alg >= 1 && alg <= 10) {
 		R = new Result*[qn];
 		for (int i = 0; i < qn; ++i) {
-			R[i] = new Result[MAXK];
+			R[i] = new Result[g_max_k];
 		}
-		if (read_ground_truth(qn, truth_set, R)) exit(1);
+		if (vecs_type(truth_set) == 'i') {
+			if (read_vecs_truth(n, qn, d, truth_set, (const float **) data, 
+				(const float **) query, R)) exit(1);
+		}
+		else if (read_ground_truth(qn, truth_set, R)) exit(1);
 	}
 
 	if (alg >= 8 && alg <= 10) {
-		pre    = new float*[MAX_ROUND];
-		recall = new float*[MAX_ROUND];
+		pre    = new float*[g_topk.size()];
+		recall = new float*[g_topk.size()];
 
-		for (int r = 0; r < MAX_ROUND; ++r) {
+		for (int r = 0; r < (int) g_topk.size(); ++r) {
 			pre[r]    = new float[MAX_T];
 			recall[r] = new float[MAX_T];
 
@@ -261,12 +441,11 @@ int main(int nargs, char **args)
 	// -------------------------------------------------------------------------
 	switch (alg) {
 	case 0:
-		ground_truth(n, qn, d, (const float **) data, (const float **) norm_d,
-			(const float **) query, (const float **) norm_q, truth_set);
+		ground_truth(n, qn, d, dset, qset, truth_set);
 		break;
 	case 1:
-		h2_alsh(n, qn, d, nn_ratio, mip_ratio, "h2_alsh", out_path, 
-			(const float **) data, (const float **) norm_d, 
+		h2_alsh(n, qn, d, nn_ratio, mip_ratio, batch, index_file, "h2_alsh", 
+			out_path, (const float **) data, (const float **) norm_d, 
 			(const float **) query, (const float **) norm_q, 
 			(const Result **) R);
 		break;
@@ -301,9 +480,7 @@ int main(int nargs, char **args)
 			(const Result **) R);
 		break;
 	case 7:
-		linear_scan(n, qn, d, "linear_scan", out_path, 
-			(const float **) data, (const float **) norm_d, 
-			(const float **) query, (const float **) norm_q, 
+		linear_scan(n, qn, d, batch, "linear_scan", out_path, dset, qset,
 			(const Result **) R);
 		break;
 	case 8:
@@ -337,21 +514,8 @@ int main(int nargs, char **args)
 	// -------------------------------------------------------------------------
 	//  release space
 	// -------------------------------------------------------------------------
-	for (int i = 0; i < n; ++i) {
-		delete[] data[i];
-		delete[] norm_d[i];
-	}
-	delete[] data;
-	delete[] norm_d;
-
-    if (alg >= 0 && alg <= 10) {
-        for (int i = 0; i < qn; ++i) {
-            delete[] query[i];
-            delete[] norm_q[i];
-        }
-        delete[] query;
-        delete[] norm_q;
-    }
+	delete dset; dset = NULL;
+	if (qset != NULL) { delete qset; qset = NULL; }
 
 	if (alg >= 1 && alg <= 10) {
 		for (int i = 0; i < qn; ++i) {
@@ -361,7 +525,7 @@ int main(int nargs, char **args)
 	}
 
 	if (alg >= 8 && alg <= 10) {
-		for (int r = 0; r < MAX_ROUND; ++r) {
+		for (int r = 0; r < (int) g_topk.size(); ++r) {
 			delete[] pre[r];
 			delete[] recall[r];
 		}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace mips {
+
+extern int g_num_threads;			// global param: number of threads
+extern int g_query_threads;			// global param: number of query threads
+
+// -----------------------------------------------------------------------------
+//  parallel_for: run func(tid, begin, end) over [0, n) in chunks of grain
+//  items on g_num_threads threads. chunks are handed out dynamically, so that
+//  uneven work (e.g., blocks of different sizes) is balanced. tid is in
+//  [0, g_num_threads) and can be used to index per-thread state. a different
+//  number of threads (e.g., g_query_threads) can be given by threads.
+// -----------------------------------------------------------------------------
+template<class Func>
+void parallel_for(					// parallel loop over [0, n)
+	int   n,							// number of items
+	int   grain,						// number of items per chunk
+	Func  func,							// func(tid, begin, end)
+	int   threads = 0)					// number of threads (0: g_num_threads)
+{
+	if (n <= 0) return;
+	grain = std::max(grain, 1);
+	if (threads <= 0) threads = g_num_threads;
+
+	int num_chunks  = (n + grain - 1) / grain;
+	int num_threads = std::min(std::max(threads, 1), num_chunks);
+	if (num_threads == 1) { func(0, 0, n); return; }
+
+	std::atomic<int> next(0);
+	auto worker = [&](int tid) {
+		while (true) {
+			int begin = next.fetch_add(grain);
+			if (begin >= n) break;
+			func(tid, begin, std::min(begin + grain, n));
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < num_threads; ++i) pool.emplace_back(worker, i);
+	worker(0);
+	for (auto &t : pool) t.join();
+}
+
+} // end namespace mips
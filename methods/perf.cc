@@ -0,0 +1,160 @@
+#include "perf.h"
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace mips {
+
+bool g_perf = false;				// global param: use perf counters
+
+static const char *PERF_NAMES[PERF_NUM_EVENTS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+	"branch_misses"
+};
+
+// -----------------------------------------------------------------------------
+static int open_event(				// open a counter of the calling process
+	uint32_t type,						// type of event
+	uint64_t config)					// config of event
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.type           = type;
+	attr.config         = config;
+	attr.disabled       = 1;
+	attr.inherit        = 1;			// count the threads created later
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// -----------------------------------------------------------------------------
+static uint64_t cache_miss(			// config of a cache read miss event
+	uint64_t cache)						// cache id
+{
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// -----------------------------------------------------------------------------
+Perf_Counters::Perf_Counters()		// constructor (open counters)
+{
+	fd_[PERF_CYCLES] = open_event(PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CPU_CYCLES);
+	fd_[PERF_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS);
+	fd_[PERF_L1D_MISSES] = open_event(PERF_TYPE_HW_CACHE,
+		cache_miss(PERF_COUNT_HW_CACHE_L1D));
+	fd_[PERF_LLC_MISSES] = open_event(PERF_TYPE_HW_CACHE,
+		cache_miss(PERF_COUNT_HW_CACHE_LL));
+	fd_[PERF_DTLB_MISSES] = open_event(PERF_TYPE_HW_CACHE,
+		cache_miss(PERF_COUNT_HW_CACHE_DTLB));
+	fd_[PERF_BRANCH_MISSES] = open_event(PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_BRANCH_MISSES);
+
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) value_[i] = -1;
+	queries_ = 0;
+	if (!available()) {
+		printf("Could not open perf counters (see perf_event_paranoid)\n");
+	}
+}
+
+// -----------------------------------------------------------------------------
+Perf_Counters::~Perf_Counters()		// destructor (close counters)
+{
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		if (fd_[i] >= 0) { close(fd_[i]); fd_[i] = -1; }
+	}
+}
+
+// -----------------------------------------------------------------------------
+bool Perf_Counters::available()		// whether any counter is available
+{
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		if (fd_[i] >= 0) return true;
+	}
+	return false;
+}
+
+// -----------------------------------------------------------------------------
+void Perf_Counters::start()			// reset and enable counters
+{
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		if (fd_[i] < 0) continue;
+		ioctl(fd_[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd_[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+// -----------------------------------------------------------------------------
+void Perf_Counters::stop(			// disable counters and read value_
+	int   queries)						// number of queries since start
+{
+	queries_ = queries;
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		if (fd_[i] >= 0) ioctl(fd_[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		value_[i] = -1;
+		if (fd_[i] < 0) continue;
+
+		// value, time enabled, time running
+		uint64_t buf[3];
+		if (read(fd_[i], buf, sizeof(buf)) != (ssize_t) sizeof(buf)) continue;
+		if (buf[2] == 0) continue;	// never scheduled on a counter
+
+		// scale up if the counter was multiplexed with others
+		double scale = buf[2] < buf[1] ? (double) buf[1] / buf[2] : 1.0;
+		value_[i] = (int64_t) (buf[0] * scale);
+	}
+}
+
+// -----------------------------------------------------------------------------
+void Perf_Counters::write(			// append value_ per query to a table
+	const char *out_path,				// output path
+	const char *method_name,			// name of method
+	int   top_k)						// top-k value
+{
+	// -------------------------------------------------------------------------
+	//  one tab-separated line per (method, top-k), counts per query (-1: n/a)
+	// -------------------------------------------------------------------------
+	char fname[200];
+	sprintf(fname, "%sperf.tsv", out_path);
+
+	struct stat st;
+	bool  exists = stat(fname, &st) == 0;
+	FILE *fp = fopen(fname, "a+");
+	if (!fp) { printf("Could not create %s\n", fname); return; }
+
+	if (!exists) {
+		fprintf(fp, "method\ttop_k\tqueries");
+		for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+			fprintf(fp, "\t%s", PERF_NAMES[i]);
+		}
+		fprintf(fp, "\tipc\n");
+	}
+	fprintf(fp, "%s\t%d\t%d", method_name, top_k, queries_);
+	printf("  perf (per query):");
+	for (int i = 0; i < PERF_NUM_EVENTS; ++i) {
+		double val = value_[i] < 0 ? -1.0 : 
+			(double) value_[i] / MAX(queries_, 1);
+		fprintf(fp, "\t%.1f", val);
+		printf(" %s=%.0f", PERF_NAMES[i], val);
+	}
+	double ipc = -1.0;
+	if (value_[PERF_CYCLES] > 0 && value_[PERF_INSTRUCTIONS] >= 0) {
+		ipc = (double) value_[PERF_INSTRUCTIONS] / value_[PERF_CYCLES];
+	}
+	fprintf(fp, "\t%.3f\n", ipc);
+	printf(" ipc=%.3f\n", ipc);
+	fclose(fp);
+}
+
+} // end namespace mips
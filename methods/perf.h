@@ -0,0 +1,63 @@
+#pragma once
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "def.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  Perf_Counters: hardware performance counters of the calling process read by
+//  the Linux perf_event_open interface. the counters follow the threads that
+//  are created after start (e.g., by parallel_for), and are scaled when the
+//  kernel multiplexes them. counters which are not supported (e.g., in a VM
+//  or with a strict perf_event_paranoid) are reported as -1.
+// -----------------------------------------------------------------------------
+enum Perf_Event {					// hardware events
+	PERF_CYCLES       = 0,
+	PERF_INSTRUCTIONS = 1,
+	PERF_L1D_MISSES   = 2,
+	PERF_LLC_MISSES   = 3,
+	PERF_DTLB_MISSES  = 4,
+	PERF_BRANCH_MISSES = 5,
+	PERF_NUM_EVENTS   = 6
+};
+
+extern bool g_perf;					// global param: use perf counters
+
+// -----------------------------------------------------------------------------
+class Perf_Counters {
+public:
+	int64_t value_[PERF_NUM_EVENTS]; // counts of last start/stop (-1: n/a)
+	int   queries_;					// number of queries of last start/stop
+
+	// -------------------------------------------------------------------------
+	Perf_Counters();				// constructor (open counters)
+
+	// -------------------------------------------------------------------------
+	~Perf_Counters();				// destructor (close counters)
+
+	// -------------------------------------------------------------------------
+	bool available();				// whether any counter is available
+
+	// -------------------------------------------------------------------------
+	void start();					// reset and enable counters
+
+	// -------------------------------------------------------------------------
+	void stop(						// disable counters and read value_
+		int   queries);					// number of queries since start
+
+	// -------------------------------------------------------------------------
+	void write(						// append value_ per query to a table
+		const char *out_path,			// output path
+		const char *method_name,		// name of method
+		int   top_k);					// top-k value
+
+protected:
+	int   fd_[PERF_NUM_EVENTS];		// file descriptors of counters
+};
+
+} // end namespace mips
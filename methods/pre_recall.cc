@@ -52,15 +52,15 @@ int h2_alsh_precision_recall(		// precision-recall curve of h2_alsh
 			list->reset();
 			lsh->kmip(top_t, query[i], norm_q[i], list);
 
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
+			for (int r = 0; r < (int) g_topk.size(); ++r) {
+				int top_k = g_topk[r];
 				int hits  = get_hits(top_t, top_k, R[i], list);
 
 				pre[r][t]    += (float) hits / (float) top_t;
 				recall[r][t] += (float) hits / (float) top_k;
 			}
 		}
-		for (int r = 0; r < MAX_ROUND; ++r) {
+		for (int r = 0; r < (int) g_topk.size(); ++r) {
 			pre[r][t] = pre[r][t] * 100.0f / qn;
 			recall[r][t] = recall[r][t] * 100.0f / qn;
 		}
@@ -131,15 +131,15 @@ int sign_alsh_precision_recall(		// precision-recall curve of sign_alsh
 			list->reset();
 			lsh->kmip(top_t, query[i], norm_q[i], list);
 
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
+			for (int r = 0; r < (int) g_topk.size(); ++r) {
+				int top_k = g_topk[r];
 				int hits  = get_hits(top_t, top_k, R[i], list);
 
 				pre[r][t]    += hits / (float) top_t;
 				recall[r][t] += hits / (float) top_k;
 			}
 		}
-		for (int r = 0; r < MAX_ROUND; ++r) {
+		for (int r = 0; r < (int) g_topk.size(); ++r) {
 			pre[r][t] = pre[r][t] * 100.0f / qn;
 			recall[r][t] = recall[r][t] * 100.0f / qn;
 		}
@@ -208,15 +208,15 @@ int simple_lsh_precision_recall(	// precision-recall curve of simple_lsh
 			list->reset();
 			lsh->kmip(top_t, query[i], norm_q[i], list);
 
-			for (int r = 0; r < MAX_ROUND; ++r) {
-				int top_k = TOPK[r];
+			for (int r = 0; r < (int) g_topk.size(); ++r) {
+				int top_k = g_topk[r];
 				int hits  = get_hits(top_t, top_k, R[i], list);
 
 				pre[r][t]    += hits / (float) top_t;
 				recall[r][t] += hits / (float) top_k;
 			}
 		}
-		for (int r = 0; r < MAX_ROUND; ++r) {
+		for (int r = 0; r < (int) g_topk.size(); ++r) {
 			pre[r][t] = pre[r][t] * 100.0f / qn;
 			recall[r][t] = recall[r][t] * 100.0f / qn;
 		}
@@ -47,72 +47,89 @@ int ResultCompDesc(					// cmp func for qsort (descending)
 }
 
 // -----------------------------------------------------------------------------
-MinK_List::MinK_List(				// constructor (given max size)
-	int max)							// max size
-{
-	num_  = 0;
-	k_    = max;
-	list_ = new Result[max + 1];
-}
+//  ResultSort: LSD radix sort on (key_, id_) with 11-bit digits. keys are 
+//  mapped to unsigned integers of the same order (negative floats are 
+//  flipped, -0.0 is treated as 0.0), and each pass is a stable counting sort. 
+//  the id passes are skipped if ids are already ascending (e.g., the hash 
+//  tables of QALSH), and so are the passes whose digit is the same for all 
+//  results.
+// -----------------------------------------------------------------------------
+const int RADIX_BITS = 11;			// bits of a digit
+const int RADIX_SIZE = 1 << RADIX_BITS; // number of buckets of a digit
+const int RADIX_MIN  = 256;			// use qsort for fewer results
 
 // -----------------------------------------------------------------------------
-MinK_List::~MinK_List() 			// destructor
+static inline uint32_t key_bits(	// map a float key to an ordered integer
+	float key)							// key
 {
-	if (list_ != NULL) {
-		delete[] list_; list_ = NULL;
-	}
+	uint32_t u = 0;
+	if (key != 0.0f) memcpy(&u, &key, sizeof(u));
+	return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
 }
 
 // -----------------------------------------------------------------------------
-float MinK_List::insert(			// insert item (inline for speed)
-	float key,							// key of item
-	int id)								// id of item
+static void radix_pass(				// one pass of stable counting sort
+	int   n,							// number of results
+	int   shift,						// shift of digit
+	bool  by_key,						// digit of key (or id)
+	const Result *src,					// source
+	Result *dst)						// destination (return)
 {
-	int i = 0;
-	for (i = num_; i > 0; --i) {
-		if (key < list_[i-1].key_) list_[i] = list_[i - 1];
-		else break;
+	int cnt[RADIX_SIZE + 1] = { 0 };
+	const uint32_t mask = RADIX_SIZE - 1;
+	for (int i = 0; i < n; ++i) {
+		uint32_t u = by_key ? key_bits(src[i].key_) 
+			: (uint32_t) src[i].id_ ^ 0x80000000u;
+		++cnt[((u >> shift) & mask) + 1];
 	}
-	list_[i].key_ = key;			// store new item here
-	list_[i].id_ = id;
-	if (num_ < k_) ++num_;			// increase the number of items
+	for (int i = 0; i < RADIX_SIZE; ++i) cnt[i + 1] += cnt[i];
 
-	return max_key();
+	for (int i = 0; i < n; ++i) {
+		uint32_t u = by_key ? key_bits(src[i].key_) 
+			: (uint32_t) src[i].id_ ^ 0x80000000u;
+		dst[cnt[(u >> shift) & mask]++] = src[i];
+	}
 }
 
-
 // -----------------------------------------------------------------------------
-MaxK_List::MaxK_List(				// constructor (given max size)
-	int max)							// max size
+void ResultSort(					// sort results by LSD radix sort (ascending)
+	int   n,							// number of results
+	Result *res)						// results (return, same order as ResultComp)
 {
-	num_  = 0;
-	k_    = max;
-	list_ = new Result[max + 1];
-}
+	if (n < RADIX_MIN) { qsort(res, n, sizeof(Result), ResultComp); return; }
 
-// -----------------------------------------------------------------------------
-MaxK_List::~MaxK_List() 			// destructor
-{
-	if (list_ != NULL) {
-		delete[] list_; list_ = NULL;
+	// -------------------------------------------------------------------------
+	//  find the digits which differ among results
+	// -------------------------------------------------------------------------
+	bool sorted_id = true;
+	uint32_t key_or = 0, key_and = ~0u, id_or = 0, id_and = ~0u;
+	for (int i = 0; i < n; ++i) {
+		uint32_t k = key_bits(res[i].key_);
+		uint32_t d = (uint32_t) res[i].id_ ^ 0x80000000u;
+		key_or |= k; key_and &= k;
+		id_or  |= d; id_and  &= d;
+		if (i > 0 && res[i].id_ < res[i-1].id_) sorted_id = false;
 	}
-}
+	uint32_t key_diff = key_or ^ key_and;
+	uint32_t id_diff  = sorted_id ? 0 : id_or ^ id_and;
 
-// -----------------------------------------------------------------------------
-float MaxK_List::insert(			// insert item
-	float key,							// key of item
-	int id)								// id of item
-{
-	int i = 0;
-	for (i = num_; i > 0; i--) {
-		if (list_[i-1].key_ < key) list_[i] = list_[i - 1];
-		else break;
-	}
-	list_[i].key_ = key;			// store new item here
-	list_[i].id_ = id;
-	if (num_ < k_) ++num_;			// increase the number of items
+	// -------------------------------------------------------------------------
+	//  sort by id (the minor key) first, then by key
+	// -------------------------------------------------------------------------
+	Result *buf = new Result[n];
+	Result *src = res, *dst = buf;
+	const uint32_t mask = RADIX_SIZE - 1;
+	for (int pass = 0; pass < 2; ++pass) {
+		uint32_t diff = pass == 0 ? id_diff : key_diff;
+		for (int shift = 0; shift < 32; shift += RADIX_BITS) {
+			if (((diff >> shift) & mask) == 0) continue;
 
-	return min_key();
+			radix_pass(n, shift, pass == 1, src, dst);
+			std::swap(src, dst);
+		}
+	}
+	if (src != res) memcpy(res, src, sizeof(Result) * n);
+	delete[] buf;
 }
 
 } // end namespace mips
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
 #include "def.h"
+#include "simd.h"
 
 namespace mips {
 
@@ -31,92 +36,302 @@ int ResultCompDesc(					// compare function for qsort (descending)
 	const void *e1,						// 1st element
 	const void *e2);					// 2nd element
 
+// -----------------------------------------------------------------------------
+void ResultSort(					// sort results by LSD radix sort (ascending)
+	int   n,							// number of results
+	Result *res);						// results (return, same order as ResultComp)
+
 
 // -----------------------------------------------------------------------------
-//  MinK_List: a structure which maintains the smallest k values (of type float)
-//  and associated object id (of type int).
+//  TopK_List: a structure which maintains the best k keys (of type float) and
+//  associated object ids (of type int), where Order::better(a, b) tells if 
+//  key a is better than key b. the container is chosen by k:
 //
-//  This structure is used for ANN search
+//  k <= TOPK_SORTED_MAX: a sorted array, insertion by shifting (O(k), but the
+//      fastest for tiny k)
+//  k <= TOPK_HEAP_MAX: a binary heap with the k-th key at its root (O(log k))
+//  otherwise: a buffer of 2k items behind a threshold filter, compacted by 
+//      nth_element when full (O(1) amortized). its threshold is the k-th key
+//      of the last compaction, i.e., a bound of the k-th key
+//
+//  insert returns the threshold: the k-th key (or its bound), or the worst 
+//  key if fewer than k items are kept. ties are broken by insertion order 
+//  (the earlier first), so all containers keep the same items in the same 
+//  order. the heap and the buffer are sorted lazily when their items are 
+//  read by ith_key, ith_id, or size.
+// -----------------------------------------------------------------------------
+enum TopK_Kind {					// containers of TopK_List
+	TOPK_SORTED = 0,
+	TOPK_HEAP   = 1,
+	TOPK_BUFFER = 2
+};
+
+// -----------------------------------------------------------------------------
+struct TopK_Item {					// an item of heap and buffer
+	float key_;							// key
+	int   id_;							// object id
+	int   seq_;							// insertion order (for ties)
+};
+
+// -----------------------------------------------------------------------------
+struct Max_Order {					// larger keys are better
+	static inline bool better(float a, float b) { return a > b; }
+	static inline float worst() { return MINREAL; }
+
+	// positions of the keys better than a threshold (SIMD kernel)
+	static inline int filter(int n, float thres, const float *key, int *pos) {
+		return g_filter(n, thres, key, pos);
+	}
+};
+
+// -----------------------------------------------------------------------------
+struct Min_Order {					// smaller keys are better
+	static inline bool better(float a, float b) { return a < b; }
+	static inline float worst() { return MAXREAL; }
+
+	// positions of the keys better than a threshold
+	static inline int filter(int n, float thres, const float *key, int *pos) {
+		int cnt = 0;
+		for (int j = 0; j < n; ++j) { pos[cnt] = j; cnt += key[j] < thres; }
+		return cnt;
+	}
+};
+
 // -----------------------------------------------------------------------------
-class MinK_List {
+template<class Order>
+class TopK_List {
 public:
-	MinK_List(int max);				// constructor (given max size)
-	~MinK_List();					// destructor
+	TopK_List(int max)				// constructor (given max size)
+		: k_(max), num_(0), seq_(0), dirty_(false), heap_(true), 
+		compacted_(false), thres_(Order::worst())
+	{
+		kind_  = max <= TOPK_SORTED_MAX ? TOPK_SORTED : 
+			(max <= TOPK_HEAP_MAX ? TOPK_HEAP : TOPK_BUFFER);
+		list_  = new Result[max + 1];
+		items_ = NULL;
+		if (kind_ != TOPK_SORTED) {
+			items_ = new TopK_Item[kind_ == TOPK_BUFFER ? 2 * max : max];
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	~TopK_List()					// destructor
+	{
+		delete[] list_;  list_  = NULL;
+		delete[] items_; items_ = NULL;
+	}
 
 	// -------------------------------------------------------------------------
-	inline void reset() { num_ = 0; }
+	inline void reset()
+	{
+		num_ = 0; seq_ = 0; dirty_ = false; heap_ = true; compacted_ = false;
+		thres_ = Order::worst();
+	}
 
 	// -------------------------------------------------------------------------
-	inline float min_key() { return (num_ > 0 ? list_[0].key_ : MAXREAL); }
+	inline int kind() { return kind_; }
 
 	// -------------------------------------------------------------------------
-	inline float max_key() { return (num_>=k_ ? list_[k_-1].key_ : MAXREAL); }
+	inline float threshold()		// the k-th key (or its bound)
+	{
+		if (kind_ != TOPK_SORTED) return thres_;
+		return num_ == k_ ? list_[k_-1].key_ : Order::worst();
+	}
 
 	// -------------------------------------------------------------------------
-	inline float ith_key(int i) { return (i < num_ ? list_[i].key_ : MAXREAL); }
+	inline float best_key() { finish(); return ith_key(0); }
 
 	// -------------------------------------------------------------------------
-	inline int ith_id(int i) { return (i < num_ ? list_[i].id_ : MININT); }
+	inline float ith_key(int i) 
+	{
+		finish(); return i < num_ ? list_[i].key_ : Order::worst();
+	}
 
 	// -------------------------------------------------------------------------
-	inline int size() { return num_; }
+	inline int ith_id(int i) { finish(); return i < num_ ? list_[i].id_ : MININT; }
 
 	// -------------------------------------------------------------------------
-	inline bool isFull() { if (num_ >= k_) return true; else return false; }
+	inline int size() { finish(); return num_; }
 
 	// -------------------------------------------------------------------------
-	float insert(					// insert item
+	inline bool isFull() { return size() >= k_; }
+
+	// -------------------------------------------------------------------------
+	inline float insert(			// insert item
 		float key,						// key of item
-		int id);						// id of item
+		int id)							// id of item
+	{
+		if (kind_ == TOPK_SORTED) {
+			int i = 0;
+			for (i = num_; i > 0; --i) {
+				if (Order::better(key, list_[i-1].key_)) list_[i] = list_[i-1];
+				else break;
+			}
+			list_[i].key_ = key;	// store new item here
+			list_[i].id_  = id;
+			if (num_ < k_) ++num_;	// increase the number of items
 
-protected:
-	int    k_;						// max numner of keys
-	int    num_;					// number of key current active
-	Result *list_;					// the list itself
-};
+			return threshold();
+		}
+		if (kind_ == TOPK_HEAP) return insert_heap(key, id);
+		return insert_buffer(key, id);
+	}
 
+	// -------------------------------------------------------------------------
+	float insert_block(				// insert a block of items
+		int   n,						// number of items
+		const float *key,				// keys of items
+		const int *id,					// ids of items (id[j] + id_add)
+		int   id_add)					// value added to ids
+	{
+		// ---------------------------------------------------------------------
+		//  filter the keys by the threshold before each TOPK_BLOCK keys, and
+		//  insert the items which pass it and beat the current threshold. as
+		//  for a loop of "if (key > threshold) insert", keys which are not 
+		//  better than the worst key are skipped
+		// ---------------------------------------------------------------------
+		int   pos[TOPK_BLOCK];
+		float thres = threshold();
+		for (int base = 0; base < n; base += TOPK_BLOCK) {
+			int m   = n - base < TOPK_BLOCK ? n - base : TOPK_BLOCK;
+			int cnt = Order::filter(m, thres, key + base, pos);
+			for (int j = 0; j < cnt; ++j) {
+				int p = base + pos[j];
+				if (Order::better(key[p], thres)) {
+					thres = insert(key[p], id[p] + id_add);
+				}
+			}
+		}
+		return thres;
+	}
 
-// -----------------------------------------------------------------------------
-//  MaxK_List: An MaxK_List structure is one which maintains the largest k 
-//  values (of type float) and associated object id (of type int).
-//
-//  This structure is used for MIP search
-// -----------------------------------------------------------------------------
-class MaxK_List {
-public:
-	MaxK_List(int max);				// constructor (given max size)
-	~MaxK_List();					// destructor
+protected:
+	int   k_;						// max number of keys
+	int   kind_;					// container (TopK_Kind)
+	int   num_;						// number of items
+	int   seq_;						// number of items inserted
+	bool  dirty_;					// whether items_ are newer than list_
+	bool  heap_;					// whether items_ is a heap
+	bool  compacted_;				// whether the buffer has been compacted
+	float thres_;					// threshold of heap and buffer
+	Result *list_;					// the sorted list
+	TopK_Item *items_;				// the heap or buffer
 
 	// -------------------------------------------------------------------------
-	inline void reset() { num_ = 0; }
+	struct Better_Item {			// item a before item b
+		inline bool operator()(const TopK_Item &a, const TopK_Item &b) const {
+			return Order::better(a.key_, b.key_) || 
+				(a.key_ == b.key_ && a.seq_ < b.seq_);
+		}
+	};
 
 	// -------------------------------------------------------------------------
-	inline float max_key() { return num_ > 0 ? list_[0].key_ : MINREAL; }
+	float insert_heap(				// insert item into heap
+		float key,						// key of item
+		int id)							// id of item
+	{
+		// the root of the heap is the worst item, i.e., the k-th one
+		if (!heap_) { std::make_heap(items_, items_ + num_, Better_Item()); }
+		heap_ = true;
+
+		TopK_Item item = { key, id, seq_++ };
+		if (num_ < k_) {
+			items_[num_++] = item;
+			std::push_heap(items_, items_ + num_, Better_Item());
+		}
+		else if (Order::better(key, items_[0].key_)) {
+			// replace the root and sift it down
+			Better_Item before;
+			int i = 0, child = 1;
+			while (child < num_) {
+				if (child + 1 < num_ && before(items_[child], items_[child+1])) {
+					++child;		// the worse child
+				}
+				if (!before(item, items_[child])) break;
+				items_[i] = items_[child];
+				i = child; child = 2 * i + 1;
+			}
+			items_[i] = item;
+		}
+		else return thres_;			// not better than the k-th item
+
+		dirty_ = true;
+		if (num_ == k_) thres_ = items_[0].key_;
+		return thres_;
+	}
 
 	// -------------------------------------------------------------------------
-	inline float min_key() { return num_ == k_ ? list_[k_-1].key_ : MINREAL; }
+	float insert_buffer(			// insert item into buffer
+		float key,						// key of item
+		int id)							// id of item
+	{
+		if (compacted_ && !Order::better(key, thres_)) return thres_;
+
+		TopK_Item item = { key, id, seq_++ };
+		items_[num_++] = item;
+		dirty_ = true;
+		if (num_ == 2 * k_) compact();
+
+		return thres_;
+	}
 
 	// -------------------------------------------------------------------------
-	inline float ith_key(int i) { return i < num_ ? list_[i].key_ : MINREAL; }
+	void compact()					// keep the best k items of buffer
+	{
+		std::nth_element(items_, items_ + k_ - 1, items_ + num_, Better_Item());
+		num_ = k_;
+		thres_ = items_[k_-1].key_;
+		compacted_ = true;
+	}
 
 	// -------------------------------------------------------------------------
-	inline int ith_id(int i) { return i < num_ ? list_[i].id_ : MININT; }
+	inline void finish()			// sort heap or buffer into list_
+	{
+		if (!dirty_) return;
+		if (kind_ == TOPK_BUFFER && num_ > k_) compact();
+
+		std::sort(items_, items_ + num_, Better_Item());
+		for (int i = 0; i < num_; ++i) {
+			list_[i].key_ = items_[i].key_;
+			list_[i].id_  = items_[i].id_;
+		}
+		heap_  = false;
+		dirty_ = false;
+	}
+};
+
+// -----------------------------------------------------------------------------
+//  MinK_List: a structure which maintains the smallest k values (of type float)
+//  and associated object id (of type int).
+//
+//  This structure is used for ANN search
+// -----------------------------------------------------------------------------
+class MinK_List : public TopK_List<Min_Order> {
+public:
+	MinK_List(int max) : TopK_List<Min_Order>(max) {} // constructor
 
 	// -------------------------------------------------------------------------
-	inline int size() { return num_; }
+	inline float min_key() { return best_key(); }
 
 	// -------------------------------------------------------------------------
-	inline bool isFull() { if (num_ >= k_) return true; else return false; }
+	inline float max_key() { return threshold(); }
+};
+
+// -----------------------------------------------------------------------------
+//  MaxK_List: An MaxK_List structure is one which maintains the largest k 
+//  values (of type float) and associated object id (of type int).
+//
+//  This structure is used for MIP search
+// -----------------------------------------------------------------------------
+class MaxK_List : public TopK_List<Max_Order> {
+public:
+	MaxK_List(int max) : TopK_List<Max_Order>(max) {} // constructor
 
 	// -------------------------------------------------------------------------
-	float insert(					// insert item
-		float key,						// key of item
-		int id);						// id of item
+	inline float max_key() { return best_key(); }
 
-private:
-	int k_;							// max numner of keys
-	int num_;						// number of key current active
-	Result *list_;					// the list itself
+	// -------------------------------------------------------------------------
+	inline float min_key() { return threshold(); }
 };
 
 } // end namespace mips
@@ -2,12 +2,105 @@
 
 namespace mips {
 
+bool g_compact_tables = false;		// global param: 16-bit keys and ids
+
+const int MAX_CODE = 65535;			// max 16-bit code of a key
+const uint32_t EPOCH_UNIT = 1 << 16; // base_ step of QALSH_Scratch per query
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch::QALSH_Scratch(		// constructor
+	int   n,							// max number of data objects
+	int   m)							// max number of hash tables
+	: n_(n), m_(m), busy_(false)
+{
+	alloc();
+}
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch::~QALSH_Scratch()		// destructor
+{
+	release();
+}
+
+// -----------------------------------------------------------------------------
+void QALSH_Scratch::alloc()			// allocate the working space
+{
+	assert(m_ < (int) EPOCH_UNIT);	// a counter reaches at most m_ (16 bits)
+	base_        = EPOCH_UNIT;
+	slot_        = new uint32_t[n_];
+	lpos_        = new int[m_];
+	rpos_        = new int[m_];
+	bucket_flag_ = new bool[m_];
+	range_flag_  = new bool[m_];
+	q_val_       = new float[m_];
+
+	memset(slot_, 0, n_ * sizeof(uint32_t));
+}
+
+// -----------------------------------------------------------------------------
+void QALSH_Scratch::release()		// release the working space
+{
+	delete[] slot_;        slot_        = NULL;
+	delete[] lpos_;        lpos_        = NULL;
+	delete[] rpos_;        rpos_        = NULL;
+	delete[] bucket_flag_; bucket_flag_ = NULL;
+	delete[] range_flag_;  range_flag_  = NULL;
+	delete[] q_val_;       q_val_       = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH_Scratch::reserve(		// grow the working space if necessary
+	int   n,							// number of data objects
+	int   m)							// number of hash tables
+{
+	if (n <= n_ && m <= m_) return;
+
+	release();
+	n_ = MAX(n, n_);
+	m_ = MAX(m, m_);
+	alloc();
+}
+
+// -----------------------------------------------------------------------------
+void QALSH_Scratch::next_epoch()	// start a new query (reset all counters)
+{
+	base_ += EPOCH_UNIT;
+	if (base_ == 0) {				// wrap around: clear all slots once
+		memset(slot_, 0, n_ * sizeof(uint32_t));
+		base_ = EPOCH_UNIT;
+	}
+}
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch *acquire_scratch(		// get the working space of a query
+	QALSH_Scratch *given,				// working space of caller (or NULL)
+	QALSH_Scratch *shared)				// working space of index
+{
+	if (given != NULL) return given;
+	if (!shared->busy_.exchange(true, std::memory_order_acquire)) return shared;
+
+	// the one of index is used by another thread, use a private one
+	return new QALSH_Scratch(shared->n_, shared->m_);
+}
+
+// -----------------------------------------------------------------------------
+void release_scratch(				// release the working space of a query
+	QALSH_Scratch *scratch,				// returned by acquire_scratch
+	QALSH_Scratch *given,				// working space of caller (or NULL)
+	QALSH_Scratch *shared)				// working space of index
+{
+	if (scratch == given) return;
+	if (scratch == shared) shared->busy_.store(false, std::memory_order_release);
+	else delete scratch;
+}
+
 // -----------------------------------------------------------------------------
 QALSH::QALSH(						// constructor
 	int   n,							// number of data objects
 	int   d,							// dimension of data objects
-	float ratio)						// approximation ratio
-	: n_(n), d_(d), ratio_(ratio)
+	float ratio,						// approximation ratio
+	bool  own_a)						// draw (and own) lsh functions a_
+	: n_(n), d_(d), ratio_(ratio), own_a_(own_a), mapped_(false)
 {
 	// -------------------------------------------------------------------------
 	//  init parameters
@@ -29,13 +122,16 @@ QALSH::QALSH(						// constructor
 	l_ = (int) ceil(alpha * m_);
 
 	// -------------------------------------------------------------------------
-	//  generate hash functions
+	//  generate hash functions (shared ones are set by the caller)
 	// -------------------------------------------------------------------------
-	a_ = new float*[m_];
-	for (int i = 0; i < m_; ++i) { // chosen from N(0.0, 1.0)
-		a_[i] = new float[d];
-		for (int j = 0; j < d; ++j) {
-			a_[i][j] = gaussian(0.0F, 1.0F);
+	a_ = NULL;
+	if (own_a_) {
+		a_ = new float*[m_];
+		for (int i = 0; i < m_; ++i) { // chosen from N(0.0, 1.0)
+			a_[i] = new float[d];
+			for (int j = 0; j < d; ++j) {
+				a_[i][j] = gaussian(0.0F, 1.0F);
+			}
 		}
 	}
 
@@ -43,7 +139,71 @@ QALSH::QALSH(						// constructor
 	//  allocate space for hash tables
 	// -------------------------------------------------------------------------
 	tables_ = new Result*[m_];
-	for (int i = 0; i < m_; ++i) tables_[i] = new Result[n];
+	keys_   = new float*[m_];
+	ids_    = new int*[m_];
+	for (int i = 0; i < m_; ++i) {
+		tables_[i] = new Result[n];
+		keys_[i]   = NULL;
+		ids_[i]    = NULL;
+	}
+	codes_ = NULL; sids_ = NULL;
+	kmin_  = NULL; kinv_ = NULL;
+	if (g_compact_tables) {
+		codes_ = new uint16_t*[m_];
+		kmin_  = new float[m_];
+		kinv_  = new float[m_];
+		for (int i = 0; i < m_; ++i) codes_[i] = NULL;
+
+		if (n_ <= MAX_CODE + 1) {
+			sids_ = new uint16_t*[m_];
+			for (int i = 0; i < m_; ++i) sids_[i] = NULL;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+template<class T>
+static T **map_rows(				// get rows of an array in a mapped file
+	const char *base,					// start of the mapped file
+	int64_t offset,						// offset of array (0: absent)
+	int   m,							// number of rows
+	int   n)							// number of entries per row
+{
+	T **rows = new T*[m];
+	for (int i = 0; i < m; ++i) {
+		rows[i] = offset > 0 ? (T *) (base + offset) + (int64_t) i * n : NULL;
+	}
+	return rows;
+}
+
+// -----------------------------------------------------------------------------
+QALSH::QALSH(						// constructor (from a mapped index file)
+	const char *base,					// start of the mapped file
+	int64_t offset)						// offset of its QALSH_Header
+	: mapped_(true)
+{
+	const QALSH_Header *h = (const QALSH_Header *) (base + offset);
+	n_     = h->n_;
+	d_     = h->d_;
+	m_     = h->m_;
+	l_     = h->l_;
+	ratio_ = h->ratio_;
+	w_     = h->w_;
+	own_a_ = h->own_a_ != 0;
+
+	// the rows point into the mapping, shared lsh functions are set by caller
+	a_      = own_a_ ? map_rows<float>(base, h->a_, m_, d_) : NULL;
+	tables_ = NULL;
+	keys_   = map_rows<float>(base, h->keys_, m_, n_);
+	ids_    = map_rows<int>(base, h->ids_, m_, n_);
+	codes_  = NULL; sids_ = NULL;
+	kmin_   = NULL; kinv_ = NULL;
+	if (h->codes_ > 0) {
+		codes_ = map_rows<uint16_t>(base, h->codes_, m_, n_);
+		kmin_  = (float *) (base + h->kmin_);
+		kinv_  = (float *) (base + h->kinv_);
+	}
+	if (h->sids_ > 0) sids_ = map_rows<uint16_t>(base, h->sids_, m_, n_);
 }
 
 // -----------------------------------------------------------------------------
@@ -55,15 +215,136 @@ inline float QALSH::calc_p(			// calc probability
 
 // -----------------------------------------------------------------------------
 QALSH::~QALSH()						// destructor
+{
+	for (int i = 0; i < m_ && !mapped_; ++i) {
+		if (own_a_) { delete[] a_[i]; a_[i] = NULL; }
+		delete[] keys_[i]; keys_[i] = NULL;
+		delete[] ids_[i];  ids_[i]  = NULL;
+		if (tables_ != NULL) { delete[] tables_[i]; tables_[i] = NULL; }
+		if (codes_  != NULL) { delete[] codes_[i];  codes_[i]  = NULL; }
+		if (sids_   != NULL) { delete[] sids_[i];   sids_[i]   = NULL; }
+	}
+	if (!mapped_) {
+		delete[] kmin_; delete[] kinv_;
+	}
+	kmin_ = NULL; kinv_ = NULL;
+	delete[] codes_;  codes_  = NULL;
+	delete[] sids_;   sids_   = NULL;
+	if (own_a_) delete[] a_;
+	a_ = NULL;
+	delete[] keys_;   keys_   = NULL;
+	delete[] ids_;    ids_    = NULL;
+	delete[] tables_; tables_ = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::build_table(			// sort tables_[tid] into keys_ and ids_
+	int   tid)							// table id
+{
+	Result *table = tables_[tid];
+	ResultSort(n_, table);
+
+	if (codes_ == NULL) {
+		keys_[tid] = new float[n_];
+		for (int j = 0; j < n_; ++j) keys_[tid][j] = table[j].key_;
+	}
+	else {
+		// quantize keys into [0, MAX_CODE] by the min/max key of table
+		float step  = (table[n_-1].key_ - table[0].key_) / MAX_CODE;
+		kmin_[tid]  = table[0].key_;
+		kinv_[tid]  = step > 0.0f ? 1.0f / step : 0.0f;
+		codes_[tid] = new uint16_t[n_];
+		for (int j = 0; j < n_; ++j) {
+			float code = (table[j].key_ - kmin_[tid]) * kinv_[tid];
+			codes_[tid][j] = (uint16_t) MAX(0, MIN((int) code, MAX_CODE));
+		}
+	}
+
+	if (sids_ != NULL) {
+		sids_[tid] = new uint16_t[n_];
+		for (int j = 0; j < n_; ++j) sids_[tid][j] = (uint16_t) table[j].id_;
+	}
+	else {
+		ids_[tid] = new int[n_];
+		for (int j = 0; j < n_; ++j) ids_[tid][j] = table[j].id_;
+	}
+	delete[] table; tables_[tid] = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void QALSH::build_tables()			// sort tables_ into keys_ and ids_
 {
 	for (int i = 0; i < m_; ++i) {
-		delete[] a_[i]; a_[i] = NULL;
-		delete[] tables_[i]; tables_[i] = NULL;
+		if (tables_[i] != NULL) build_table(i);
 	}
-	delete[] a_; a_ = NULL;
 	delete[] tables_; tables_ = NULL;
 }
 
+// -----------------------------------------------------------------------------
+static int write_rows(				// write rows of an array to a file
+	FILE  *fp,							// file pointer (at the end of file)
+	int64_t offset,						// offset of array (0: absent)
+	const void *const *rows,			// rows of array
+	int   m,							// number of rows
+	int64_t row_bytes)					// size of a row (bytes)
+{
+	if (offset == 0) return 0;
+	if (write_padding(fp, INDEX_ALIGN) || ftello(fp) != offset) return 1;
+
+	for (int i = 0; i < m; ++i) {
+		if (fwrite(rows[i], 1, row_bytes, fp) != (size_t) row_bytes) return 1;
+	}
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int64_t QALSH::save(				// append the built index to a file
+	FILE  *fp)							// file pointer (at the end of file)
+{
+	// return the offset of its QALSH_Header in the file, or -1 if failed
+	assert(tables_ == NULL);
+	if (write_padding(fp, INDEX_PAGE)) return -1;
+	int64_t start = (int64_t) ftello(fp);
+
+	// -------------------------------------------------------------------------
+	//  lay out the arrays after the header
+	// -------------------------------------------------------------------------
+	QALSH_Header h;
+	memset(&h, 0, sizeof(h));
+	h.n_ = n_; h.d_ = d_; h.m_ = m_; h.l_ = l_;
+	h.ratio_ = ratio_; h.w_ = w_; h.own_a_ = own_a_ ? 1 : 0;
+
+	int64_t pos = start + sizeof(h);
+	auto place = [&](int64_t bytes) {
+		pos = (pos + INDEX_ALIGN - 1) / INDEX_ALIGN * INDEX_ALIGN;
+		int64_t ret = pos; pos += bytes;
+		return ret;
+	};
+	int64_t row = (int64_t) n_;
+	if (own_a_)            h.a_     = place(SIZEFLOAT * m_ * d_);
+	if (keys_[0] != NULL)  h.keys_  = place(SIZEFLOAT * m_ * row);
+	if (ids_[0]  != NULL)  h.ids_   = place(SIZEINT * m_ * row);
+	if (codes_   != NULL)  h.codes_ = place(sizeof(uint16_t) * m_ * row);
+	if (sids_    != NULL)  h.sids_  = place(sizeof(uint16_t) * m_ * row);
+	if (codes_   != NULL)  h.kmin_  = place(SIZEFLOAT * m_);
+	if (codes_   != NULL)  h.kinv_  = place(SIZEFLOAT * m_);
+
+	// -------------------------------------------------------------------------
+	//  write the header and the arrays in the same order
+	// -------------------------------------------------------------------------
+	const void *kmin = kmin_, *kinv = kinv_;
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+		write_rows(fp, h.a_,     (const void **) a_,     m_, SIZEFLOAT * d_) ||
+		write_rows(fp, h.keys_,  (const void **) keys_,  m_, SIZEFLOAT * row) ||
+		write_rows(fp, h.ids_,   (const void **) ids_,   m_, SIZEINT * row) ||
+		write_rows(fp, h.codes_, (const void **) codes_, m_, 2 * row) ||
+		write_rows(fp, h.sids_,  (const void **) sids_,  m_, 2 * row) ||
+		write_rows(fp, h.kmin_,  &kmin, 1, SIZEFLOAT * m_) ||
+		write_rows(fp, h.kinv_,  &kinv, 1, SIZEFLOAT * m_)) return -1;
+
+	return start;
+}
+
 // -----------------------------------------------------------------------------
 float QALSH::calc_hash_value(		// calc hash value
 	int   tid,							// table id
@@ -85,36 +366,216 @@ void QALSH::display()				// display parameters
 	printf("\n");
 }
 
+// -----------------------------------------------------------------------------
+//  in compact mode, an entry of code c holds a key in about [kmin + c/kinv, 
+//  kmin + (c+1)/kinv]. the window [q - lim, q + lim] is mapped to a range of 
+//  codes with a slack of 2 codes for rounding, so that the test on codes is 
+//  conservative.
+// -----------------------------------------------------------------------------
+static inline int code_floor(		// floor of a code clamped near [0, MAX_CODE]
+	double x)							// real-valued code
+{
+	return (int) MAX(-4.0, MIN(floor(x), MAX_CODE + 4.0));
+}
+
+// -----------------------------------------------------------------------------
+//  Float_Keys and Code_Keys: the sorted keys of one table in full precision 
+//  and in compact mode. knn_scan is instantiated for each of them, so that the
+//  layout of the tables is chosen once per query rather than once per entry.
+//
+//  the keys within the window of q form one run on each side of the start 
+//  position, as keys are sorted and |q - key| grows monotonically when moving 
+//  away from q. knn_scan tests the key of an entry by in_left or in_right 
+//  before it fetches the id, and beyond_left or beyond_right tell whether the 
+//  first entry out of the window is beyond the bucket width and search range.
+// -----------------------------------------------------------------------------
+struct Float_Keys {
+	const float *keys_;				// sorted keys
+	int   n_;						// number of keys
+	float q_;						// hash value of query
+	float width_;					// bucket width
+	float range_;					// search range
+	float lim_;						// max distance to q_ within window
+
+	// -------------------------------------------------------------------------
+	Float_Keys(const QALSH *lsh, int tid) 
+		: keys_(lsh->keys_[tid]), n_(lsh->n_) {}
+
+	// -------------------------------------------------------------------------
+	inline int lower_bound(float q) const
+	{
+		return std::lower_bound(keys_, keys_ + n_, q) - keys_;
+	}
+
+	// -------------------------------------------------------------------------
+	inline void set_window(float q, float width, float range)
+	{
+		q_ = q; width_ = width; range_ = range; lim_ = MIN(width, range);
+	}
+
+	// -------------------------------------------------------------------------
+	inline bool in_left(int pos) const  { return fabs(q_ - keys_[pos]) <= lim_; }
+	inline bool in_right(int pos) const { return fabs(q_ - keys_[pos]) <= lim_; }
+
+	// -------------------------------------------------------------------------
+	inline void beyond_left(int pos, bool *beyond) const
+	{
+		float dist = fabs(q_ - keys_[pos]);
+		beyond[0] = dist > width_;
+		beyond[1] = dist > range_;
+	}
+
+	// -------------------------------------------------------------------------
+	inline void beyond_right(int pos, bool *beyond) const
+	{
+		beyond_left(pos, beyond);
+	}
+};
+
+// -----------------------------------------------------------------------------
+struct Code_Keys {
+	const uint16_t *codes_;			// sorted codes
+	int   n_;						// number of codes
+	float kmin_;					// min key of table
+	float kinv_;					// inverse quantization step
+	int   lw_, lr_;					// min code within width and range
+	int   rw_, rr_;					// max code within width and range
+	int   cmin_, cmax_;				// min and max code within window
+
+	// -------------------------------------------------------------------------
+	Code_Keys(const QALSH *lsh, int tid) : codes_(lsh->codes_[tid]), 
+		n_(lsh->n_), kmin_(lsh->kmin_[tid]), kinv_(lsh->kinv_[tid]) {}
+
+	// -------------------------------------------------------------------------
+	inline int lower_bound(float q) const
+	{
+		int code = code_floor((q - (double) kmin_) * kinv_);
+		return std::lower_bound(codes_, codes_ + n_, 
+			(uint16_t) MAX(0, MIN(code, MAX_CODE))) - codes_;
+	}
+
+	// -------------------------------------------------------------------------
+	inline void set_window(float q, float width, float range)
+	{
+		lw_ = code_floor(((double) q - width - kmin_) * kinv_) - 2;
+		lr_ = code_floor(((double) q - range - kmin_) * kinv_) - 2;
+		rw_ = code_floor(((double) q + width - kmin_) * kinv_) + 2;
+		rr_ = code_floor(((double) q + range - kmin_) * kinv_) + 2;
+		cmin_ = MAX(lw_, lr_); cmax_ = MIN(rw_, rr_);
+	}
+
+	// -------------------------------------------------------------------------
+	inline bool in_left(int pos) const  { return codes_[pos] >= cmin_; }
+	inline bool in_right(int pos) const { return codes_[pos] <= cmax_; }
+
+	// -------------------------------------------------------------------------
+	inline void beyond_left(int pos, bool *beyond) const
+	{
+		beyond[0] = codes_[pos] < lw_;
+		beyond[1] = codes_[pos] < lr_;
+	}
+
+	// -------------------------------------------------------------------------
+	inline void beyond_right(int pos, bool *beyond) const
+	{
+		beyond[0] = codes_[pos] > rw_;
+		beyond[1] = codes_[pos] > rr_;
+	}
+};
+
 // -----------------------------------------------------------------------------
 int QALSH::knn(						// c-k-ANN search
 	int   top_k,						// top-k
 	float R,							// limited search range
 	const float *query,					// input query
-	std::vector<int> &cand)				// NN candidates (return)
-{
-	int   *freq        = new int[n_];
-	int   *lpos        = new int[m_];
-	int   *rpos        = new int[m_];
-	bool  *checked     = new bool[n_];
-	bool  *bucket_flag = new bool[m_];
-	bool  *range_flag  = new bool[m_];
-	float *q_val       = new float[m_];
+	std::vector<int> &cand,				// NN candidates (return)
+	QALSH_Scratch *scratch)				// working space (NULL: allocate)
+{
+	QALSH_Scratch *local = NULL;
+	if (scratch == NULL) scratch = local = new QALSH_Scratch(n_, m_);
+	else scratch->reserve(n_, m_);
+
+	// -------------------------------------------------------------------------
+	//  calc hash values of query and search by them
+	// -------------------------------------------------------------------------
+	STATS_START(t_project);
+	float *q_val = scratch->q_val_;
+	for (int i = 0; i < m_; ++i) {
+		q_val[i] = calc_inner_product(d_, (const float *) a_[i], query);
+	}
+	STATS_STOP(t_project_, t_project);
+	knn_by_hash(top_k, R, (const float *) q_val, cand, scratch);
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	if (local != NULL) { delete local; local = NULL; }
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int QALSH::knn_by_hash(				// c-k-ANN search by hash values of query
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *q_val,					// hash values of query (m_ floats)
+	std::vector<int> &cand,				// NN candidates (return)
+	QALSH_Scratch *scratch)				// working space (NULL: allocate)
+{
+	QALSH_Scratch *local = NULL;
+	if (scratch == NULL) scratch = local = new QALSH_Scratch(n_, m_);
+	else scratch->reserve(n_, m_);
+	scratch->next_epoch();
+
+	// -------------------------------------------------------------------------
+	//  choose the layout of tables once for this query
+	// -------------------------------------------------------------------------
+	if (codes_ == NULL) {
+		if (sids_ == NULL) {
+			knn_scan<Float_Keys>(top_k, R, q_val, ids_, cand, scratch);
+		}
+		else knn_scan<Float_Keys>(top_k, R, q_val, sids_, cand, scratch);
+	}
+	else {
+		if (sids_ == NULL) {
+			knn_scan<Code_Keys>(top_k, R, q_val, ids_, cand, scratch);
+		}
+		else knn_scan<Code_Keys>(top_k, R, q_val, sids_, cand, scratch);
+	}
+
+	// -------------------------------------------------------------------------
+	//  release space
+	// -------------------------------------------------------------------------
+	if (local != NULL) { delete local; local = NULL; }
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+template<class Keys, class Id>
+void QALSH::knn_scan(				// dynamic collision counting
+	int   top_k,						// top-k
+	float R,							// limited search range
+	const float *q_val,					// hash values of query (m_ floats)
+	Id    **ids,						// object ids of each table
+	std::vector<int> &cand,				// NN candidates (return)
+	QALSH_Scratch *scratch)				// working space
+{
+	uint32_t *slot     = scratch->slot_;
+	uint32_t base      = scratch->base_;
+	int   *lpos        = scratch->lpos_;
+	int   *rpos        = scratch->rpos_;
+	bool  *bucket_flag = scratch->bucket_flag_;
+	bool  *range_flag  = scratch->range_flag_;
 	
 	// -------------------------------------------------------------------------
 	//  initialize parameters
 	// -------------------------------------------------------------------------
-	memset(freq,        0,     n_ * SIZEFLOAT);
-	memset(checked,     false, n_ * SIZEBOOL);
+	STATS_START(t_lookup);
 	memset(range_flag,  true,  m_ * SIZEBOOL);
 	
-	Result tmp;
-	Result *table = NULL;
 	for (int i = 0; i < m_; ++i) {
-		tmp.key_= calc_inner_product(d_, (const float *) a_[i], query);
-		q_val[i] = tmp.key_;
-
-		table = tables_[i];
-		int pos = std::lower_bound(table, table+n_, tmp, cmp) - table;
+		int pos = Keys(this, i).lower_bound(q_val[i]);
 		if (pos <= 0) {
 			lpos[i] = -1; rpos[i] = pos;
 		}
@@ -126,7 +587,9 @@ int QALSH::knn(						// c-k-ANN search
 	// -------------------------------------------------------------------------
 	//  k-nn search via dynamic collision counting
 	// -------------------------------------------------------------------------
-	int   candidates = CANDIDATES + top_k - 1; // candidate size
+	STATS_STOP(t_lookup_, t_lookup);
+	STATS_START(t_scan);
+	int   candidates = get_candidates(top_k); // candidate size
 	int   cand_cnt   = 0;			// candidate counter
 	int   num_range  = 0;			// number of search range flag
 
@@ -148,66 +611,74 @@ int QALSH::knn(						// c-k-ANN search
 			for (int j = 0; j < m_; ++j) {
 				if (!bucket_flag[j]) continue;
 
-				table = tables_[j];
-				float q_v = q_val[j], ldist = -1.0f, rdist = -1.0f;
+				Keys  keys(this, j);
+				const Id *row = ids[j];
+				bool  lflag[2], rflag[2]; // beyond width and range
+				keys.set_window(q_val[j], width, range);
 				// -------------------------------------------------------------
 				//  step 2.1: scan the left part of hash table
 				// -------------------------------------------------------------
-				int cnt = 0;
-				int pos = lpos[j];
-				while (cnt < SCAN_SIZE) {
-					ldist = MAXREAL;
-					if (pos >= 0) {
-						ldist = fabs(q_v - table[pos].key_);
-					}
-					else break;
-					if (ldist > width || ldist > range) break;
-
-					int id = table[pos].id_;
-					if (++freq[id] >= l_ && !checked[id]) {
-						checked[id] = true;
+				int start = lpos[j];
+				int stop  = MAX(start - SCAN_SIZE, -1);
+				int pos   = start;
+				for (; pos > stop && keys.in_left(pos); --pos) {
+					// an object becomes a candidate when its counter reaches l_
+					int id = row[pos];
+					STATS_ADD(collisions_, 1);
+					if (QALSH_Scratch::add_collision(slot, base, id) == l_) {
 						cand.push_back(id);
 
 						if (++cand_cnt >= candidates) break;
 					}
-					--pos; ++cnt;
 				}
+				STATS_ADD(entries_, start - pos);
 				if (cand_cnt >= candidates) break;
 				lpos[j] = pos;
 
+				if (start - pos == SCAN_SIZE) {	// scan size is used up
+					lflag[0] = lflag[1] = false;
+				}
+				else if (pos < 0) {		// reach the beginning of table
+					lflag[0] = lflag[1] = true;
+				}
+				else keys.beyond_left(pos, lflag);
+
 				// -------------------------------------------------------------
 				//  step 2.2: scan right part of hash table
 				// -------------------------------------------------------------
-				cnt = 0;
-				pos = rpos[j];
-				while (cnt < SCAN_SIZE) {
-					rdist = MAXREAL;
-					if (pos < n_) {
-						rdist = fabs(q_v - table[pos].key_);
-					}
-					else break;
-					if (rdist > width || rdist > range) break;
-
-					int id = table[pos].id_;
-					if (++freq[id] >= l_ && !checked[id]) {
-						checked[id] = true;
+				start = rpos[j];
+				stop  = MIN(start + SCAN_SIZE, n_);
+				pos   = start;
+				for (; pos < stop && keys.in_right(pos); ++pos) {
+					// an object becomes a candidate when its counter reaches l_
+					int id = row[pos];
+					STATS_ADD(collisions_, 1);
+					if (QALSH_Scratch::add_collision(slot, base, id) == l_) {
 						cand.push_back(id);
 
 						if (++cand_cnt >= candidates) break;
 					}
-					++pos; ++cnt;
 				}
+				STATS_ADD(entries_, pos - start);
 				if (cand_cnt >= candidates) break;
 				rpos[j] = pos;
 
+				if (pos - start == SCAN_SIZE) {	// scan size is used up
+					rflag[0] = rflag[1] = false;
+				}
+				else if (pos >= n_) {	// reach the end of table
+					rflag[0] = rflag[1] = true;
+				}
+				else keys.beyond_right(pos, rflag);
+
 				// -------------------------------------------------------------
 				//  step 2.3: whether this bucket width is finished scanned
 				// -------------------------------------------------------------
-				if (ldist > width && rdist > width) {
+				if (lflag[0] && rflag[0]) {
 					bucket_flag[j] = false;
 					if (++num_bucket > m_) break;
 				}
-				if (ldist > range && rdist > range) {
+				if (lflag[1] && rflag[1]) {
 					if (bucket_flag[j]) {
 						bucket_flag[j] = false;
 						if (++num_bucket > m_) break;
@@ -231,19 +702,8 @@ int QALSH::knn(						// c-k-ANN search
 		radius = ratio_ * radius;
 		width  = radius * w_ / 2.0f;
 	}
-	// -------------------------------------------------------------------------
-	//  release space
-	// -------------------------------------------------------------------------
-	delete[] freq;        freq        = NULL;
-	delete[] lpos;        lpos        = NULL;
-	delete[] rpos;        rpos        = NULL;
-	
-	delete[] checked;     checked     = NULL;
-	delete[] bucket_flag; bucket_flag = NULL;
-	delete[] range_flag;  range_flag  = NULL;
-	delete[] q_val;       q_val       = NULL;
-
-	return 0;
+	STATS_STOP(t_scan_, t_scan);
+	STATS_ADD(candidates_, cand_cnt);
 }
 
 } // end namespace mips
@@ -6,18 +6,153 @@
 #include <cstring>
 #include <cmath>
 #include <vector>
+#include <atomic>
 
 #include "def.h"
 #include "util.h"
 #include "random.h"
 #include "pri_queue.h"
+#include "stats.h"
 
 namespace mips {
 
+// -----------------------------------------------------------------------------
+//  QALSH_Scratch: the working space of QALSH::knn, owned by the caller and 
+//  reused across queries (one per thread). it can be shared by several QALSH 
+//  indexes (e.g., the blocks of H2_ALSH) as long as it is large enough.
+//
+//  the collision counters are reset lazily by an epoch stamp per object, so 
+//  that the cost of a query is proportional to the objects it touches rather 
+//  than to n. the stamp and the counter of an object are packed into one 
+//  uint32_t (epoch in the high 16 bits, counter in the low 16 bits, as an 
+//  object collides at most once per table), so that a collision touches a 
+//  single word and the slots take no more cache than plain counters. as 
+//  epochs only grow (until they wrap around and all slots are cleared), a 
+//  slot below the base of current epoch is stale and is reset by a compare.
+//
+//  the indexes keep one QALSH_Scratch of their own for callers that do not 
+//  pass any; it is handed out by acquire_scratch to one thread at a time, so 
+//  that concurrent queries never share a working space.
+// -----------------------------------------------------------------------------
+class QALSH_Scratch {
+public:
+	int   n_;						// max number of data objects
+	int   m_;						// max number of hash tables
+	uint32_t base_;					// epoch of current query << 16
+	uint32_t *slot_;				// epoch and counter of each object
+	int   *lpos_;					// left  scan position of each table
+	int   *rpos_;					// right scan position of each table
+	bool  *bucket_flag_;			// whether the bucket of a table is active
+	bool  *range_flag_;				// whether the range of a table is active
+	float *q_val_;					// hash values of query
+	std::atomic<bool> busy_;		// whether in use (shared by an index)
+
+	// -------------------------------------------------------------------------
+	QALSH_Scratch(					// constructor
+		int   n,						// max number of data objects
+		int   m);						// max number of hash tables
+
+	// -------------------------------------------------------------------------
+	~QALSH_Scratch();				// destructor
+
+	// -------------------------------------------------------------------------
+	void reserve(					// grow the working space if necessary
+		int   n,						// number of data objects
+		int   m);						// number of hash tables
+
+	// -------------------------------------------------------------------------
+	void next_epoch();				// start a new query (reset all counters)
+
+	// -------------------------------------------------------------------------
+	static inline int add_collision( // increase the counter of an object
+		uint32_t *slot,					// slot_ (loaded once per query)
+		uint32_t base,					// base_ (loaded once per query)
+		int   id)						// object id
+	{
+		uint32_t v = slot[id];
+		v = (v < base ? base : v) + 1;
+		slot[id] = v;
+		return (int) (v - base);
+	}
+
+	// -------------------------------------------------------------------------
+	int64_t get_memory_usage()		// get memory usage
+	{
+		int64_t ret = 0;
+		ret += sizeof(*this);
+		ret += sizeof(uint32_t) * n_; // for slot_
+		ret += (SIZEINT * 2 + SIZEBOOL * 2 + SIZEFLOAT) * m_; // for the rest
+		return ret;
+	}
+
+protected:
+	void alloc();					// allocate the working space
+	void release();					// release the working space
+};
+
+// -----------------------------------------------------------------------------
+QALSH_Scratch *acquire_scratch(		// get the working space of a query
+	QALSH_Scratch *given,				// working space of caller (or NULL)
+	QALSH_Scratch *shared);				// working space of index
+
+// -----------------------------------------------------------------------------
+void release_scratch(				// release the working space of a query
+	QALSH_Scratch *scratch,				// returned by acquire_scratch
+	QALSH_Scratch *given,				// working space of caller (or NULL)
+	QALSH_Scratch *shared);				// working space of index
+
+extern bool g_compact_tables;		// global param: 16-bit keys and ids
+
+// -----------------------------------------------------------------------------
+//  QALSH_Header: header of a qalsh saved by QALSH::save. it starts on a page 
+//  of the index file and is followed by the arrays of the index (64-byte 
+//  aligned, m_ rows of n_ entries each), whose offsets are relative to the 
+//  start of the file (0: absent).
+// -----------------------------------------------------------------------------
+struct QALSH_Header {
+	int32_t n_;						// number of data objects
+	int32_t d_;						// dimensionality
+	int32_t m_;						// number of hash tables
+	int32_t l_;						// collision threshold
+	float   ratio_;					// approximation ratio
+	float   w_;						// bucket width
+	int32_t own_a_;					// whether a_ is saved with the index
+	int32_t reserved_;				// reserved (0)
+	int64_t a_;						// offset of a_    (m_ x d_ floats)
+	int64_t keys_;					// offset of keys_ (m_ x n_ floats)
+	int64_t ids_;					// offset of ids_  (m_ x n_ ints)
+	int64_t codes_;					// offset of codes_ (m_ x n_ uint16)
+	int64_t sids_;					// offset of sids_  (m_ x n_ uint16)
+	int64_t kmin_;					// offset of kmin_ (m_ floats)
+	int64_t kinv_;					// offset of kinv_ (m_ floats)
+};
+
 // -----------------------------------------------------------------------------
 //  Query-Aware Locality-Sensitive Hashing (QALSH) is used to solve the problem 
 //  of c-Approximate Nearest Neighbor (c-ANN) search.
 //
+//  the hash tables are filled into tables_ by the caller and then converted by 
+//  build_table (tables can be built on different threads) and build_tables 
+//  into a structure of arrays: knn only reads the contiguous 
+//  keys_ of a table to find the entries within the search width, and fetches 
+//  ids_ only for those entries.
+//
+//  in compact mode (g_compact_tables), keys are quantized to 16-bit codes 
+//  relative to the min/max key of each table, and ids are stored in 16 bits 
+//  if n_ <= 65536 (e.g., the blocks of H2_ALSH). the window tests on codes are
+//  conservative: an entry is scanned whenever its original key could be 
+//  within the window, so no collision of the full-precision tables is missed.
+//
+//  the lsh functions a_ can be shared by several QALSH indexes (own_a_ is 
+//  false), in which case the caller sets a_ to a matrix of at least m_ rows 
+//  after construction and releases it, and may project a query once for all 
+//  of them by knn_by_hash.
+//
+//  a built index is written by save into an index file, and can be created 
+//  from a (read-only) mapping of that file, in which case the rows of a_, 
+//  keys_, ids_, codes_, and sids_ point into the mapping (mapped_ is true) 
+//  and are neither copied nor released.
+//
 //  the idea was introduced by Qiang Huang, Jianlin Feng, Yikai Zhang, Qiong 
 //  Fang, and Wilfred Ng in their paper "Query-aware locality-sensitive hashing 
 //  for approximate nearest neighbor search", in Proceedings of the VLDB 
@@ -31,14 +166,28 @@ public:
 	float  w_;						// bucket width
 	int    m_;						// number of hash tables
 	int    l_;						// collision threshold
+	bool   own_a_;					// whether a_ is owned by this index
+	bool   mapped_;					// whether the arrays are in a mapping
 	float  **a_;					// lsh functions
-	Result **tables_;				// hash tables
+	Result **tables_;				// hash tables under construction
+	float  **keys_;					// sorted hash values of each table
+	int    **ids_;					// object ids aligned with keys_
+	uint16_t **codes_;				// quantized keys_ (compact mode)
+	uint16_t **sids_;				// 16-bit ids_ (compact mode, n_ <= 65536)
+	float  *kmin_;					// min key of each table (compact mode)
+	float  *kinv_;					// inverse quantization step (compact mode)
 
 	// -------------------------------------------------------------------------
 	QALSH(							// constructor
 		int   n,						// number of data objects
 		int   d,						// dimensionality
-		float ratio);					// approximation ratio
+		float ratio,					// approximation ratio
+		bool  own_a = true);			// draw (and own) lsh functions a_
+
+	// -------------------------------------------------------------------------
+	QALSH(							// constructor (from a mapped index file)
+		const char *base,				// start of the mapped file
+		int64_t offset);				// offset of its QALSH_Header
 
 	// -------------------------------------------------------------------------
 	~QALSH();						// destructor
@@ -52,6 +201,17 @@ public:
 		int   tid,						// table id
 		const float *data);				// input data
 
+	// -------------------------------------------------------------------------
+	void build_table(				// sort tables_[tid] into keys_ and ids_
+		int   tid);						// table id
+
+	// -------------------------------------------------------------------------
+	void build_tables();			// sort the remaining tables_ and release it
+
+	// -------------------------------------------------------------------------
+	int64_t save(					// append the built index to a file
+		FILE  *fp);						// file pointer (at the end of file)
+
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
@@ -60,17 +220,43 @@ public:
 		int   top_k,					// top-k
 		float R,						// limited search range
 		const float *query,				// input query
-		std::vector<int> &cand);		// NN candidates (return)
+		std::vector<int> &cand,			// NN candidates (return)
+		QALSH_Scratch *scratch = NULL);	// working space (NULL: allocate)
+
+	// -------------------------------------------------------------------------
+	int knn_by_hash(				// c-k-ANN search by hash values of query
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *q_val,				// hash values of query (m_ floats)
+		std::vector<int> &cand,			// NN candidates (return)
+		QALSH_Scratch *scratch = NULL);	// working space (NULL: allocate)
 
 	// -------------------------------------------------------------------------
 	int64_t get_memory_usage()		// get memory usage
 	{
 		int64_t ret = 0;
 		ret += sizeof(*this);
-		ret += SIZEFLOAT * m_ * d_;	// for a_
-		ret += sizeof(Result) * m_ * n_; // for tables_
+		if (own_a_) ret += SIZEFLOAT * m_ * d_; // for a_
+		if (keys_[0] != NULL) ret += (int64_t) SIZEFLOAT * m_ * n_; 
+		if (ids_[0]  != NULL) ret += (int64_t) SIZEINT * m_ * n_;
+		if (codes_ != NULL) {		// for codes_, kmin_, and kinv_
+			ret += (int64_t) sizeof(uint16_t) * m_ * n_ + SIZEFLOAT * m_ * 2;
+		}
+		if (sids_ != NULL) ret += (int64_t) sizeof(uint16_t) * m_ * n_;
+		if (tables_ != NULL) ret += (int64_t) sizeof(Result) * m_ * n_;
 		return ret;
 	}
+
+protected:
+	// -------------------------------------------------------------------------
+	template<class Keys, class Id>
+	void knn_scan(					// dynamic collision counting
+		int   top_k,					// top-k
+		float R,						// limited search range
+		const float *q_val,				// hash values of query (m_ floats)
+		Id    **ids,					// object ids of each table
+		std::vector<int> &cand,			// NN candidates (return)
+		QALSH_Scratch *scratch);		// working space
 };
 
 } // end namespace mips
@@ -55,8 +55,9 @@ Sign_ALSH::Sign_ALSH(				// constructor
 		for (int j = 0; j < K; ++j) {
 			hash_code[j] = lsh_->calc_hash_code(j, sign_alsh_data);
 		}
-		lsh_->compress_hash_code((const bool*) hash_code, lsh_->hash_key_[i]);
+		lsh_->set_hash_code(i, (const bool*) hash_code);
 	}
+	lsh_->build_tables();
 
 	// -------------------------------------------------------------------------
 	//  build hash tables for qalsh for new format of data
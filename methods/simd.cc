@@ -0,0 +1,780 @@
+#include "simd.h"
+#include "random.h"
+#include "stats.h"
+
+#include <chrono>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIPS_X86
+#endif
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  Scalar kernels
+// -----------------------------------------------------------------------------
+static float ip_scalar(				// full inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	float ret = 0.0f;
+	for (int i = 0; i < dim; ++i) {
+		ret += p1[i] * p2[i];
+	}
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+static float ip_prune_scalar(		// inner product with pruning
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norms of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norms of 2nd point
+{
+	float ip = 0.0f;
+	int base = 0;
+	for (int t = 1; t <= g_prune.num_ && base < dim; ++t) {
+		int end = MIN(g_prune.pos_[t-1], dim);
+		for (int i = base; i < end; ++i) {
+			ip += p1[i] * p2[i];
+		}
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(ip_pruned_, 1); return ip;
+		}
+		base = end;
+	}
+	for (int i = base; i < dim; ++i) {
+		ip += p1[i] * p2[i];
+	}
+	return ip;
+}
+
+// -----------------------------------------------------------------------------
+template<IP_Func IP>
+static void ip_block_pairs(			// inner products of a block, pair by pair
+	int   dim,							// dimension
+	int   nq,							// number of 1st points
+	const float **q,					// 1st points
+	int   np,							// number of 2nd points
+	const float **p,					// 2nd points
+	float *ip)							// inner products (return)
+{
+	for (int i = 0; i < nq; ++i) {
+		for (int j = 0; j < np; ++j) {
+			ip[(int64_t) i * np + j] = IP(dim, q[i], p[j]);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+static inline uint32_t popcount64(	// number of 1 bits of x (portable)
+	uint64_t x)							// input uint64_t value
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (uint32_t) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+// -----------------------------------------------------------------------------
+static void hamming_scalar(			// hamming distances to a query
+	int   n,							// number of objects (padded)
+	int   m,							// number of uint64_t words per object
+	int64_t stride,						// stride between word arrays
+	const uint64_t *sigs,				// transposed signatures
+	const uint64_t *query,				// signature of query (m words)
+	uint16_t *dist)						// hamming distances (return)
+{
+	for (int i = 0; i < n; i += HAMMING_BLOCK) {
+		uint32_t cnt[HAMMING_BLOCK] = { 0 };
+		for (int j = 0; j < m; ++j) {
+			const uint64_t *w = sigs + j * stride + i;
+			for (int k = 0; k < HAMMING_BLOCK; ++k) {
+				cnt[k] += popcount64(w[k] ^ query[j]);
+			}
+		}
+		for (int k = 0; k < HAMMING_BLOCK; ++k) dist[i+k] = (uint16_t) cnt[k];
+	}
+}
+
+// -----------------------------------------------------------------------------
+static int filter_scalar(			// positions of keys > threshold
+	int   n,							// number of keys
+	float threshold,					// threshold
+	const float *key,					// keys
+	int   *pos)							// positions (return, n at most)
+{
+	int cnt = 0;
+	for (int j = 0; j < n; ++j) {	// branch-free: always write, then advance
+		pos[cnt] = j; cnt += key[j] > threshold;
+	}
+	return cnt;
+}
+
+#ifdef MIPS_X86
+// -----------------------------------------------------------------------------
+//  AVX-512 filter kernel (16 keys per compress store)
+// -----------------------------------------------------------------------------
+__attribute__((target("avx512f,popcnt")))
+static int filter_avx512(			// positions of keys > threshold
+	int   n,							// number of keys
+	float threshold,					// threshold
+	const float *key,					// keys
+	int   *pos)							// positions (return, n at most)
+{
+	__m512  th  = _mm512_set1_ps(threshold);
+	__m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 
+		12, 13, 14, 15);
+	__m512i step = _mm512_set1_epi32(16);
+
+	int cnt = 0;
+	for (int j = 0; j < n; j += 16) {
+		__mmask16 load = n - j >= 16 ? (__mmask16) 0xffff : 
+			(__mmask16) ((1u << (n - j)) - 1);
+		__m512 v = _mm512_maskz_loadu_ps(load, key + j);
+		__mmask16 gt = _mm512_mask_cmp_ps_mask(load, v, th, _CMP_GT_OQ);
+		_mm512_mask_compressstoreu_epi32(pos + cnt, gt, idx);
+		cnt += __builtin_popcount((unsigned) gt);
+		idx  = _mm512_add_epi32(idx, step);
+	}
+	return cnt;
+}
+
+// -----------------------------------------------------------------------------
+//  POPCNT kernel (1 word per instruction)
+// -----------------------------------------------------------------------------
+__attribute__((target("popcnt")))
+static void hamming_popcnt(			// hamming distances to a query
+	int   n,							// number of objects (padded)
+	int   m,							// number of uint64_t words per object
+	int64_t stride,						// stride between word arrays
+	const uint64_t *sigs,				// transposed signatures
+	const uint64_t *query,				// signature of query (m words)
+	uint16_t *dist)						// hamming distances (return)
+{
+	for (int i = 0; i < n; i += HAMMING_BLOCK) {
+		uint32_t cnt[HAMMING_BLOCK] = { 0 };
+		for (int j = 0; j < m; ++j) {
+			const uint64_t *w = sigs + j * stride + i;
+			for (int k = 0; k < HAMMING_BLOCK; ++k) {
+				cnt[k] += (uint32_t) __builtin_popcountll(w[k] ^ query[j]);
+			}
+		}
+		for (int k = 0; k < HAMMING_BLOCK; ++k) dist[i+k] = (uint16_t) cnt[k];
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  AVX-512 VPOPCNTDQ kernel (8 words of 8 objects per instruction)
+// -----------------------------------------------------------------------------
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static void hamming_avx512(			// hamming distances to a query
+	int   n,							// number of objects (padded)
+	int   m,							// number of uint64_t words per object
+	int64_t stride,						// stride between word arrays
+	const uint64_t *sigs,				// transposed signatures
+	const uint64_t *query,				// signature of query (m words)
+	uint16_t *dist)						// hamming distances (return)
+{
+	for (int i = 0; i < n; i += HAMMING_BLOCK) {
+		__m512i cnt = _mm512_setzero_si512();
+		for (int j = 0; j < m; ++j) {
+			__m512i w = _mm512_loadu_si512(sigs + j * stride + i);
+			__m512i x = _mm512_xor_si512(w, _mm512_set1_epi64(query[j]));
+			cnt = _mm512_add_epi64(cnt, _mm512_popcnt_epi64(x));
+		}
+		_mm_storeu_si128((__m128i*) (dist + i), _mm512_cvtepi64_epi16(cnt));
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  SSE kernels (4 floats per register)
+// -----------------------------------------------------------------------------
+static inline float hsum_sse(		// horizontal sum of 4 floats
+	__m128 v)							// input register
+{
+	__m128 sh = _mm_movehl_ps(v, v);
+	v  = _mm_add_ps(v, sh);
+	sh = _mm_shuffle_ps(v, v, 1);
+	v  = _mm_add_ss(v, sh);
+	return _mm_cvtss_f32(v);
+}
+
+// -----------------------------------------------------------------------------
+static float ip_sse(				// full inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	__m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+	__m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= dim; i += 16) {
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(p1+i),    _mm_loadu_ps(p2+i)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(p1+i+4),  _mm_loadu_ps(p2+i+4)));
+		s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(p1+i+8),  _mm_loadu_ps(p2+i+8)));
+		s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(p1+i+12), _mm_loadu_ps(p2+i+12)));
+	}
+	for (; i + 4 <= dim; i += 4) {
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(p1+i), _mm_loadu_ps(p2+i)));
+	}
+	float ret = hsum_sse(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+	for (; i < dim; ++i) ret += p1[i] * p2[i];
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+static float ip_prune_sse(			// inner product with pruning
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norms of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norms of 2nd point
+{
+	float ip = 0.0f;
+	int base = 0;
+	for (int t = 1; t <= g_prune.num_ && base < dim; ++t) {
+		int end = MIN(g_prune.pos_[t-1], dim);
+		ip += ip_sse(end - base, p1 + base, p2 + base);
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(ip_pruned_, 1); return ip;
+		}
+		base = end;
+	}
+	return ip + ip_sse(dim - base, p1 + base, p2 + base);
+}
+
+// -----------------------------------------------------------------------------
+//  AVX2 + FMA kernels (8 floats per register)
+// -----------------------------------------------------------------------------
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx(		// horizontal sum of 8 floats
+	__m256 v)							// input register
+{
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+	return hsum_sse(_mm_add_ps(lo, hi));
+}
+
+// -----------------------------------------------------------------------------
+__attribute__((target("avx2,fma")))
+static float ip_avx2(				// full inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	__m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+	__m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= dim; i += 32) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i),    _mm256_loadu_ps(p2+i),    s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+8),  _mm256_loadu_ps(p2+i+8),  s1);
+		s2 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+16), _mm256_loadu_ps(p2+i+16), s2);
+		s3 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i+24), _mm256_loadu_ps(p2+i+24), s3);
+	}
+	for (; i + 8 <= dim; i += 8) {
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(p1+i), _mm256_loadu_ps(p2+i), s0);
+	}
+	float ret = hsum_avx(_mm256_add_ps(_mm256_add_ps(s0, s1),
+		_mm256_add_ps(s2, s3)));
+	for (; i < dim; ++i) ret += p1[i] * p2[i];
+
+	return ret;
+}
+
+// -----------------------------------------------------------------------------
+__attribute__((target("avx2,fma")))
+static float ip_prune_avx2(			// inner product with pruning
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norms of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norms of 2nd point
+{
+	float ip = 0.0f;
+	int base = 0;
+	for (int t = 1; t <= g_prune.num_ && base < dim; ++t) {
+		int end = MIN(g_prune.pos_[t-1], dim);
+		ip += ip_avx2(end - base, p1 + base, p2 + base);
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(ip_pruned_, 1); return ip;
+		}
+		base = end;
+	}
+	return ip + ip_avx2(dim - base, p1 + base, p2 + base);
+}
+
+// -----------------------------------------------------------------------------
+__attribute__((target("avx2,fma")))
+static void ip_block_avx2(			// inner products of a block
+	int   dim,							// dimension
+	int   nq,							// number of 1st points
+	const float **q,					// 1st points
+	int   np,							// number of 2nd points
+	const float **p,					// 2nd points
+	float *ip)							// inner products (return)
+{
+	int i = 0;
+	for (; i + 2 <= nq; i += 2) {
+		const float *q0 = q[i], *q1 = q[i+1];
+		float *ip0 = ip + (int64_t) i * np, *ip1 = ip0 + np;
+
+		int j = 0;
+		for (; j + 4 <= np; j += 4) {
+			const float *p0 = p[j], *p1 = p[j+1], *p2 = p[j+2], *p3 = p[j+3];
+			__m256 s00 = _mm256_setzero_ps(), s01 = _mm256_setzero_ps();
+			__m256 s02 = _mm256_setzero_ps(), s03 = _mm256_setzero_ps();
+			__m256 s10 = _mm256_setzero_ps(), s11 = _mm256_setzero_ps();
+			__m256 s12 = _mm256_setzero_ps(), s13 = _mm256_setzero_ps();
+			int k = 0;
+			for (; k + 8 <= dim; k += 8) {
+				__m256 a0 = _mm256_loadu_ps(q0+k), a1 = _mm256_loadu_ps(q1+k);
+				__m256 b = _mm256_loadu_ps(p0+k);
+				s00 = _mm256_fmadd_ps(a0, b, s00); s10 = _mm256_fmadd_ps(a1, b, s10);
+				b = _mm256_loadu_ps(p1+k);
+				s01 = _mm256_fmadd_ps(a0, b, s01); s11 = _mm256_fmadd_ps(a1, b, s11);
+				b = _mm256_loadu_ps(p2+k);
+				s02 = _mm256_fmadd_ps(a0, b, s02); s12 = _mm256_fmadd_ps(a1, b, s12);
+				b = _mm256_loadu_ps(p3+k);
+				s03 = _mm256_fmadd_ps(a0, b, s03); s13 = _mm256_fmadd_ps(a1, b, s13);
+			}
+			float r[8] = { hsum_avx(s00), hsum_avx(s01), hsum_avx(s02), 
+				hsum_avx(s03), hsum_avx(s10), hsum_avx(s11), hsum_avx(s12), 
+				hsum_avx(s13) };
+			for (; k < dim; ++k) {
+				r[0] += q0[k]*p0[k]; r[1] += q0[k]*p1[k];
+				r[2] += q0[k]*p2[k]; r[3] += q0[k]*p3[k];
+				r[4] += q1[k]*p0[k]; r[5] += q1[k]*p1[k];
+				r[6] += q1[k]*p2[k]; r[7] += q1[k]*p3[k];
+			}
+			for (int t = 0; t < 4; ++t) { ip0[j+t] = r[t]; ip1[j+t] = r[4+t]; }
+		}
+		for (; j < np; ++j) {
+			ip0[j] = ip_avx2(dim, q0, p[j]); ip1[j] = ip_avx2(dim, q1, p[j]);
+		}
+	}
+	for (; i < nq; ++i) {
+		for (int j = 0; j < np; ++j) {
+			ip[(int64_t) i * np + j] = ip_avx2(dim, q[i], p[j]);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+//  AVX-512 kernels (16 floats per register)
+// -----------------------------------------------------------------------------
+__attribute__((target("avx512f,avx2,fma"), always_inline))
+static inline float ip_avx512(		// full inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2)					// 2nd point
+{
+	__m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+	__m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 64 <= dim; i += 64) {
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i),    _mm512_loadu_ps(p2+i),    s0);
+		s1 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+16), _mm512_loadu_ps(p2+i+16), s1);
+		s2 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+32), _mm512_loadu_ps(p2+i+32), s2);
+		s3 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i+48), _mm512_loadu_ps(p2+i+48), s3);
+	}
+	for (; i + 16 <= dim; i += 16) {
+		s0 = _mm512_fmadd_ps(_mm512_loadu_ps(p1+i), _mm512_loadu_ps(p2+i), s0);
+	}
+	if (i < dim) {					// masked tail, never reads past dim
+		__mmask16 mask = (__mmask16) ((1u << (dim - i)) - 1);
+		s1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, p1+i),
+			_mm512_maskz_loadu_ps(mask, p2+i), s1);
+	}
+	return _mm512_reduce_add_ps(_mm512_add_ps(_mm512_add_ps(s0, s1),
+		_mm512_add_ps(s2, s3)));
+}
+
+// -----------------------------------------------------------------------------
+__attribute__((target("avx512f,avx2,fma")))
+static float ip_prune_avx512(		// inner product with pruning
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norms of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2)					// l2-norms of 2nd point
+{
+	float ip = 0.0f;
+	int base = 0;
+	for (int t = 1; t <= g_prune.num_ && base < dim; ++t) {
+		int end = MIN(g_prune.pos_[t-1], dim);
+		ip += ip_avx512(end - base, p1 + base, p2 + base);
+		if (ip + norm1[t]*norm2[t] <= threshold) {
+			STATS_ADD(ip_pruned_, 1); return ip;
+		}
+		base = end;
+	}
+	return ip + ip_avx512(dim - base, p1 + base, p2 + base);
+}
+// -----------------------------------------------------------------------------
+__attribute__((target("avx512f,avx2,fma")))
+static void ip_block_avx512(		// inner products of a block
+	int   dim,							// dimension
+	int   nq,							// number of 1st points
+	const float **q,					// 1st points
+	int   np,							// number of 2nd points
+	const float **p,					// 2nd points
+	float *ip)							// inner products (return)
+{
+	int i = 0;
+	for (; i + 2 <= nq; i += 2) {
+		const float *q0 = q[i], *q1 = q[i+1];
+		float *ip0 = ip + (int64_t) i * np, *ip1 = ip0 + np;
+
+		int j = 0;
+		for (; j + 4 <= np; j += 4) {
+			const float *p0 = p[j], *p1 = p[j+1], *p2 = p[j+2], *p3 = p[j+3];
+			__m512 s00 = _mm512_setzero_ps(), s01 = _mm512_setzero_ps();
+			__m512 s02 = _mm512_setzero_ps(), s03 = _mm512_setzero_ps();
+			__m512 s10 = _mm512_setzero_ps(), s11 = _mm512_setzero_ps();
+			__m512 s12 = _mm512_setzero_ps(), s13 = _mm512_setzero_ps();
+			for (int k = 0; k < dim; k += 16) {
+				// masked tail, never reads past dim
+				__mmask16 mask = dim - k >= 16 ? (__mmask16) 0xffff : 
+					(__mmask16) ((1u << (dim - k)) - 1);
+				__m512 a0 = _mm512_maskz_loadu_ps(mask, q0+k);
+				__m512 a1 = _mm512_maskz_loadu_ps(mask, q1+k);
+				__m512 b  = _mm512_maskz_loadu_ps(mask, p0+k);
+				s00 = _mm512_fmadd_ps(a0, b, s00); s10 = _mm512_fmadd_ps(a1, b, s10);
+				b = _mm512_maskz_loadu_ps(mask, p1+k);
+				s01 = _mm512_fmadd_ps(a0, b, s01); s11 = _mm512_fmadd_ps(a1, b, s11);
+				b = _mm512_maskz_loadu_ps(mask, p2+k);
+				s02 = _mm512_fmadd_ps(a0, b, s02); s12 = _mm512_fmadd_ps(a1, b, s12);
+				b = _mm512_maskz_loadu_ps(mask, p3+k);
+				s03 = _mm512_fmadd_ps(a0, b, s03); s13 = _mm512_fmadd_ps(a1, b, s13);
+			}
+			ip0[j]   = _mm512_reduce_add_ps(s00); ip0[j+1] = _mm512_reduce_add_ps(s01);
+			ip0[j+2] = _mm512_reduce_add_ps(s02); ip0[j+3] = _mm512_reduce_add_ps(s03);
+			ip1[j]   = _mm512_reduce_add_ps(s10); ip1[j+1] = _mm512_reduce_add_ps(s11);
+			ip1[j+2] = _mm512_reduce_add_ps(s12); ip1[j+3] = _mm512_reduce_add_ps(s13);
+		}
+		for (; j < np; ++j) {
+			ip0[j] = ip_avx512(dim, q0, p[j]); ip1[j] = ip_avx512(dim, q1, p[j]);
+		}
+	}
+	for (; i < nq; ++i) {
+		for (int j = 0; j < np; ++j) {
+			ip[(int64_t) i * np + j] = ip_avx512(dim, q[i], p[j]);
+		}
+	}
+}
+#endif // MIPS_X86
+
+// -----------------------------------------------------------------------------
+//  Dispatch
+// -----------------------------------------------------------------------------
+static const IP_Kernels KERNELS[] = {
+	{ SIMD_SCALAR, "Scalar",  ip_scalar, ip_prune_scalar, 
+		ip_block_pairs<ip_scalar> },
+#ifdef MIPS_X86
+	{ SIMD_SSE,    "SSE",     ip_sse,    ip_prune_sse,    
+		ip_block_pairs<ip_sse> },
+	{ SIMD_AVX2,   "AVX2",    ip_avx2,   ip_prune_avx2,   ip_block_avx2   },
+	{ SIMD_AVX512, "AVX-512", ip_avx512, ip_prune_avx512, ip_block_avx512 },
+#endif
+};
+
+// -----------------------------------------------------------------------------
+int simd_max_level()				// the widest SIMD level of the CPU
+{
+#ifdef MIPS_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return SIMD_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) return SIMD_SSE;
+#endif
+	return SIMD_SCALAR;
+}
+
+// -----------------------------------------------------------------------------
+const IP_Kernels *get_ip_kernels(	// get the kernels of a SIMD level
+	int   level)						// SIMD level
+{
+	level = MAX(SIMD_SCALAR, MIN(level, simd_max_level()));
+	return &KERNELS[level];
+}
+
+IP_Kernels g_ip = *get_ip_kernels(SIMD_AVX512);
+
+// -----------------------------------------------------------------------------
+static const Hamming_Kernel HAMMING_KERNELS[] = {
+	{ "Scalar",       hamming_scalar },
+#ifdef MIPS_X86
+	{ "POPCNT",       hamming_popcnt },
+	{ "AVX-512 VPOPCNTDQ", hamming_avx512 },
+#endif
+};
+
+// -----------------------------------------------------------------------------
+const Hamming_Kernel *get_hamming_kernel( // get the hamming kernel of a level
+	int   level)						// SIMD level
+{
+	level = MAX(SIMD_SCALAR, MIN(level, simd_max_level()));
+#ifdef MIPS_X86
+	if (level >= SIMD_AVX512 && __builtin_cpu_supports("avx512vpopcntdq")) {
+		return &HAMMING_KERNELS[2];
+	}
+	if (level >= SIMD_SSE && __builtin_cpu_supports("popcnt")) {
+		return &HAMMING_KERNELS[1];
+	}
+#endif
+	return &HAMMING_KERNELS[0];
+}
+
+Hamming_Kernel g_hamming = *get_hamming_kernel(SIMD_AVX512);
+
+// -----------------------------------------------------------------------------
+Filter_Func get_filter_kernel(		// get the filter kernel of a level
+	int   level)						// SIMD level
+{
+	level = MAX(SIMD_SCALAR, MIN(level, simd_max_level()));
+#ifdef MIPS_X86
+	if (level >= SIMD_AVX512) return filter_avx512;
+#endif
+	return filter_scalar;
+}
+
+Filter_Func g_filter = get_filter_kernel(SIMD_AVX512);
+
+// -----------------------------------------------------------------------------
+bool set_simd_level(				// select the kernels of a SIMD level
+	int   level)						// SIMD level (capped by simd_max_level)
+{
+	g_ip = *get_ip_kernels(level);
+	g_hamming = *get_hamming_kernel(level);
+	g_filter  = get_filter_kernel(level);
+	return g_ip.level_ == level;
+}
+
+// -----------------------------------------------------------------------------
+Prune_Schedule g_prune = { PRUNE_NUM, { PRUNE_STEP, 2 * PRUNE_STEP } };
+
+// -----------------------------------------------------------------------------
+int set_prune_schedule(				// set the checkpoints of pruning
+	int   dim,							// dimensionality
+	int   step,							// step (or first position) of checkpoints
+	int   num,							// max number of checkpoints (<= 0: all)
+	bool  geometric)					// positions step*2^t instead of step*t
+{
+	// checkpoints at or beyond dim cannot prune anything, skip them
+	int max_num = (num <= 0 || num >= MAX_NORM_K) ? MAX_NORM_K - 1 : num;
+	int64_t pos = MAX(step, 1);
+
+	g_prune.num_ = 0;
+	while (g_prune.num_ < max_num && pos < dim) {
+		g_prune.pos_[g_prune.num_++] = (int) pos;
+		pos = geometric ? pos * 2 : pos + MAX(step, 1);
+	}
+	return g_prune.num_;
+}
+
+// -----------------------------------------------------------------------------
+int simd_benchmark(					// check and benchmark all SIMD kernels
+	const char *out_path)				// output path
+{
+	const int dims[] = { 50, 128, 300, 960 };
+	const int num_dims = sizeof(dims) / sizeof(int);
+	const int n = 4096;				// number of vectors per dimension
+	const int rounds = 50;			// rounds of timing
+
+	FILE *fp = NULL;
+	if (out_path != NULL && out_path[0] != '\0') {
+		char output_set[200];
+		sprintf(output_set, "%ssimd_kernels.out", out_path);
+		fp = fopen(output_set, "a+");
+		if (!fp) { printf("Could not create %s\n", output_set); return 1; }
+	}
+
+	// -------------------------------------------------------------------------
+	//  correctness: all kernels vs. the scalar kernels for dim = 1, ..., 100
+	// -------------------------------------------------------------------------
+	int max_level = simd_max_level();
+	int errors = 0;					// errors of all levels
+	int norm_k = get_norm_k();
+	std::vector<float> a(1024), b(1024), na(norm_k), nb(norm_k);
+	for (int level = SIMD_SSE; level <= max_level; ++level) {
+		const IP_Kernels *k = get_ip_kernels(level);
+		int level_errors = 0;		// errors of this level
+		for (int dim = 1; dim <= 100; ++dim) {
+			for (int j = 0; j < dim; ++j) {
+				a[j] = gaussian(0.0f, 1.0f); b[j] = gaussian(0.0f, 1.0f);
+			}
+			// suffix norms after each checkpoint as computed by calc_norms
+			for (int t = 0; t < norm_k; ++t) {
+				float sa = 0.0f, sb = 0.0f;
+				for (int j = (t == 0 ? 0 : g_prune.pos_[t-1]); j < dim; ++j) {
+					sa += SQR(a[j]); sb += SQR(b[j]);
+				}
+				na[t] = sqrt(sa); nb[t] = sqrt(sb);
+			}
+			float tol = 1e-4f * (na[0] * nb[0] + 1.0f);
+			float ip  = ip_scalar(dim, &a[0], &b[0]);
+
+			// full inner product and pruned one without pruning
+			if (fabs(k->ip_(dim, &a[0], &b[0]) - ip) > tol) ++level_errors;
+			if (fabs(k->ip_prune_(dim, MINREAL, &a[0], &na[0], &b[0], &nb[0])
+				- ip) > tol) ++level_errors;
+
+			// a threshold that always prunes at the 1st checkpoint
+			float th = MAXREAL / 4.0f;
+			float r1 = ip_prune_scalar(dim, th, &a[0], &na[0], &b[0], &nb[0]);
+			float r2 = k->ip_prune_(dim, th, &a[0], &na[0], &b[0], &nb[0]);
+			if (fabs(r1 - r2) > tol) ++level_errors;
+
+			// a block of 3 x 6 inner products (full and partial tiles)
+			const float *qs[3], *ps[6];
+			float block[18];
+			for (int j = 0; j < 6 * dim; ++j) {
+				a[j] = gaussian(0.0f, 1.0f); b[j] = gaussian(0.0f, 1.0f);
+			}
+			for (int j = 0; j < 3; ++j) qs[j] = &a[j * dim];
+			for (int j = 0; j < 6; ++j) ps[j] = &b[j * dim];
+			k->ip_block_(dim, 3, qs, 6, ps, block);
+			for (int j = 0; j < 18; ++j) {
+				float ip = ip_scalar(dim, qs[j / 6], ps[j % 6]);
+				float tol = 1e-4f * (sqrt(ip_scalar(dim, qs[j / 6], qs[j / 6]) *
+					ip_scalar(dim, ps[j % 6], ps[j % 6])) + 1.0f);
+				if (fabs(block[j] - ip) > tol) ++level_errors;
+			}
+		}
+		printf("Check %-8s vs Scalar: %s\n", k->name_, 
+			level_errors ? "FAILED" : "OK");
+		errors += level_errors;
+	}
+	if (fp) fprintf(fp, "Correctness vs Scalar: %s\n", errors ? "FAILED" : "OK");
+
+	// -------------------------------------------------------------------------
+	//  micro-benchmark: ns per inner product, data of n vectors per dim
+	// -------------------------------------------------------------------------
+	printf("\n  d\tKernel\t\tFull (ns)\tPruned (ns)\n");
+	if (fp) fprintf(fp, "d\tKernel\tFull(ns)\tPruned(ns)\n");
+	for (int i = 0; i < num_dims; ++i) {
+		int dim = dims[i];
+		std::vector<float> data((int64_t) n * dim), norm((int64_t) n * norm_k);
+		std::vector<float> query(dim), qnorm(norm_k);
+		for (int j = 0; j < dim; ++j) query[j] = gaussian(0.0f, 1.0f);
+		for (int64_t j = 0; j < (int64_t) n * dim; ++j) {
+			data[j] = gaussian(0.0f, 1.0f);
+		}
+		for (int t = 0; t < norm_k; ++t) {
+			qnorm[t] = 0.0f;		// zero suffix norms: never prune
+			for (int j = 0; j < n; ++j) norm[j * norm_k + t] = 0.0f;
+		}
+
+		for (int level = SIMD_SCALAR; level <= max_level; ++level) {
+			const IP_Kernels *k = get_ip_kernels(level);
+			volatile float sink = 0.0f;
+			float times[2];
+			for (int mode = 0; mode < 2; ++mode) {
+				auto start = std::chrono::steady_clock::now();
+				for (int r = 0; r < rounds; ++r) {
+					float sum = 0.0f;
+					for (int j = 0; j < n; ++j) {
+						const float *p = &data[(int64_t) j * dim];
+						if (mode == 0) sum += k->ip_(dim, p, &query[0]);
+						else sum += k->ip_prune_(dim, MINREAL, p,
+							&norm[j * norm_k], &query[0], &qnorm[0]);
+					}
+					sink = sink + sum;
+				}
+				auto end = std::chrono::steady_clock::now();
+				times[mode] = std::chrono::duration<float, std::nano>(
+					end - start).count() / ((float) n * rounds);
+			}
+			printf("  %d\t%-8s\t%.2f\t\t%.2f\n", dim, k->name_, times[0],
+				times[1]);
+			if (fp) fprintf(fp, "%d\t%s\t%f\t%f\n", dim, k->name_, times[0],
+				times[1]);
+		}
+	}
+	printf("\n");
+	if (fp) fprintf(fp, "\n");
+
+	// -------------------------------------------------------------------------
+	//  hamming kernels: check vs. the scalar one, and ns per object of a scan
+	//  over hn transposed signatures of m words
+	// -------------------------------------------------------------------------
+	const int hn = 1 << 16;
+	const int hm[] = { 1, 2, 4 };
+	const int num_hm = sizeof(hm) / sizeof(int);
+
+	int hamming_errors = 0;
+	std::vector<uint64_t> sigs((int64_t) hn * hm[num_hm-1]), hq(hm[num_hm-1]);
+	std::vector<uint16_t> d1(hn), d2(hn);
+	for (size_t j = 0; j < sigs.size(); ++j) {
+		sigs[j] = ((uint64_t) rand() << 33) ^ ((uint64_t) rand() << 11) ^ 
+			(uint64_t) rand();
+	}
+	for (size_t j = 0; j < hq.size(); ++j) hq[j] = sigs[j * 7 + 3] ^ 0x5a5a;
+
+	printf("  m\tHamming Kernel\t\tScan (ns)\n");
+	if (fp) fprintf(fp, "m\tHamming Kernel\tScan(ns)\n");
+	for (int i = 0; i < num_hm; ++i) {
+		int m = hm[i];
+		hamming_scalar(hn, m, hn, &sigs[0], &hq[0], &d1[0]);
+
+		for (int level = SIMD_SCALAR; level <= max_level; ++level) {
+			const Hamming_Kernel *k = get_hamming_kernel(level);
+			if (level > SIMD_SCALAR && k == get_hamming_kernel(level - 1)) {
+				continue;			// same kernel as the level below
+			}
+			k->func_(hn, m, hn, &sigs[0], &hq[0], &d2[0]);
+			if (memcmp(&d1[0], &d2[0], sizeof(uint16_t) * hn) != 0) {
+				++hamming_errors;
+			}
+
+			volatile uint16_t sink = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < rounds; ++r) {
+				k->func_(hn, m, hn, &sigs[0], &hq[0], &d2[0]);
+				sink = sink + d2[r];
+			}
+			auto end = std::chrono::steady_clock::now();
+			float time = std::chrono::duration<float, std::nano>(
+				end - start).count() / ((float) hn * rounds);
+
+			printf("  %d\t%-20s\t%.3f\n", m, k->name_, time);
+			if (fp) fprintf(fp, "%d\t%s\t%f\n", m, k->name_, time);
+		}
+	}
+
+	// filter kernels of top-k lists vs. the scalar one
+	std::vector<float> keys(1000);
+	std::vector<int> p1(1000), p2(1000);
+	for (size_t j = 0; j < keys.size(); ++j) keys[j] = gaussian(0.0f, 1.0f);
+	for (int n = 0; n <= 1000; n += 37) {
+		Filter_Func f = get_filter_kernel(max_level);
+		int c1 = filter_scalar(n, 0.5f, &keys[0], &p1[0]);
+		int c2 = f(n, 0.5f, &keys[0], &p2[0]);
+		if (c1 != c2 || memcmp(&p1[0], &p2[0], sizeof(int) * c1) != 0) {
+			++hamming_errors;
+		}
+	}
+	printf("Check Hamming and filter kernels vs Scalar: %s\n\n", 
+		hamming_errors ? "FAILED" : "OK");
+	if (fp) {
+		fprintf(fp, "Hamming and filter correctness vs Scalar: %s\n\n", 
+			hamming_errors ? "FAILED" : "OK");
+		fclose(fp);
+	}
+
+	return errors + hamming_errors > 0 ? 1 : 0;
+}
+
+} // end namespace mips
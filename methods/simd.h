@@ -0,0 +1,157 @@
+#pragma once
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#include "def.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  SIMD kernels for inner products. the kernels of the widest instruction set
+//  supported by the CPU (SSE, AVX2+FMA, or AVX-512) are selected at startup
+//  via CPUID, and calc_inner_product in util.cc calls them through g_ip.
+//
+//  the block kernels compute the inner products of a tile of 1st points with
+//  a tile of 2nd points, 2 x 4 at a time, so that each loaded vector is used
+//  by several products (a small matrix product, e.g., for ground truth).
+//
+//  the pruned kernels keep the semantics of the scalar one: at checkpoint t,
+//  the inner product of the first g_prune.pos_[t-1] dimensions plus 
+//  norm1[t]*norm2[t] is compared with the threshold, and the partial sum is 
+//  returned as soon as it cannot exceed the threshold.
+// -----------------------------------------------------------------------------
+enum SIMD_Level {					// levels of SIMD instruction sets
+	SIMD_SCALAR = 0,
+	SIMD_SSE    = 1,
+	SIMD_AVX2   = 2,
+	SIMD_AVX512 = 3
+};
+
+// -----------------------------------------------------------------------------
+typedef float (*IP_Func)(			// full inner product
+	int   dim,							// dimension
+	const float *p1,					// 1st point
+	const float *p2);					// 2nd point
+
+// -----------------------------------------------------------------------------
+typedef float (*IP_Prune_Func)(		// inner product with partial-norm pruning
+	int   dim,							// dimension
+	float threshold,					// threshold
+	const float *p1,					// 1st point
+	const float *norm1,					// l2-norms of 1st point
+	const float *p2,					// 2nd point
+	const float *norm2);				// l2-norms of 2nd point
+
+// -----------------------------------------------------------------------------
+typedef void (*IP_Block_Func)(		// inner products of a block of points
+	int   dim,							// dimension
+	int   nq,							// number of 1st points (e.g., queries)
+	const float **q,					// 1st points
+	int   np,							// number of 2nd points (e.g., data)
+	const float **p,					// 2nd points
+	float *ip);							// ip[i*np+j] = <q[i], p[j]> (return)
+
+// -----------------------------------------------------------------------------
+struct IP_Kernels {					// a set of inner product kernels
+	int   level_;						// SIMD level
+	const char *name_;					// name of SIMD level
+	IP_Func ip_;						// full inner product
+	IP_Prune_Func ip_prune_;			// inner product with pruning
+	IP_Block_Func ip_block_;			// inner products of a block
+};
+
+extern IP_Kernels g_ip;				// global param: selected kernels
+
+// -----------------------------------------------------------------------------
+//  Hamming kernels for the signatures of SRP_LSH. the signatures are stored
+//  word by word (word j of object i at sigs[j*stride + i]), so a kernel 
+//  streams each word array and counts the bits of several objects at once 
+//  (POPCNT, or AVX-512 VPOPCNTDQ for 8 objects per instruction). n must be a
+//  multiple of HAMMING_BLOCK and stride >= n; dist[i] is the hamming 
+//  distance of object i to the query.
+// -----------------------------------------------------------------------------
+const int HAMMING_BLOCK = 8;		// objects per step of a hamming kernel
+
+typedef void (*Hamming_Func)(		// hamming distances to a query
+	int   n,							// number of objects (padded)
+	int   m,							// number of uint64_t words per object
+	int64_t stride,						// stride between word arrays
+	const uint64_t *sigs,				// transposed signatures
+	const uint64_t *query,				// signature of query (m words)
+	uint16_t *dist);					// hamming distances (return)
+
+// -----------------------------------------------------------------------------
+struct Hamming_Kernel {				// a hamming kernel
+	const char *name_;					// name of kernel
+	Hamming_Func func_;					// kernel
+};
+
+extern Hamming_Kernel g_hamming;	// global param: selected kernel
+
+// -----------------------------------------------------------------------------
+//  Filter kernels for the top-k lists: the positions of the keys greater 
+//  than a threshold, in ascending order (AVX-512 compress stores, or a 
+//  branch-free scalar loop).
+// -----------------------------------------------------------------------------
+typedef int (*Filter_Func)(			// positions of keys > threshold
+	int   n,							// number of keys
+	float threshold,					// threshold
+	const float *key,					// keys
+	int   *pos);						// positions (return, n at most)
+
+extern Filter_Func g_filter;		// global param: selected kernel
+
+// -----------------------------------------------------------------------------
+//  Prune_Schedule: the checkpoints of the pruned kernels. norm[0] of an object
+//  is its l2-norm and norm[t] (0 < t <= num_) is the l2-norm of its suffix 
+//  after the first pos_[t-1] dimensions (see calc_norms in util.cc), so the 
+//  schedule must be set before data and query sets are loaded.
+// -----------------------------------------------------------------------------
+struct Prune_Schedule {				// a schedule of pruning checkpoints
+	int   num_;							// number of checkpoints
+	int   pos_[MAX_NORM_K - 1];			// positions of checkpoints (ascending)
+};
+
+extern Prune_Schedule g_prune;		// global param: pruning schedule
+
+// -----------------------------------------------------------------------------
+inline int get_norm_k()				// number of l2-norms per object
+{
+	return g_prune.num_ + 1;
+}
+
+// -----------------------------------------------------------------------------
+int set_prune_schedule(				// set the checkpoints of pruning
+	int   dim,							// dimensionality
+	int   step,							// step (or first position) of checkpoints
+	int   num,							// max number of checkpoints (<= 0: all)
+	bool  geometric);					// positions step*2^t instead of step*t
+
+// -----------------------------------------------------------------------------
+int simd_max_level();				// the widest SIMD level of the CPU
+
+// -----------------------------------------------------------------------------
+const IP_Kernels *get_ip_kernels(	// get the kernels of a SIMD level
+	int   level);						// SIMD level
+
+// -----------------------------------------------------------------------------
+const Hamming_Kernel *get_hamming_kernel( // get the hamming kernel of a level
+	int   level);						// SIMD level
+
+// -----------------------------------------------------------------------------
+Filter_Func get_filter_kernel(		// get the filter kernel of a level
+	int   level);						// SIMD level
+
+// -----------------------------------------------------------------------------
+bool set_simd_level(				// select the kernels of a SIMD level
+	int   level);						// SIMD level (capped by simd_max_level)
+
+// -----------------------------------------------------------------------------
+int simd_benchmark(					// check and benchmark all SIMD kernels
+	const char *out_path);				// output path
+
+} // end namespace mips
@@ -2,6 +2,8 @@
 
 namespace mips {
 
+bool g_mih = false;					// global param: multi-index hashing
+
 // -----------------------------------------------------------------------------
 SRP_LSH::SRP_LSH(					// constructor
 	int   n,							// cardinality of dataset
@@ -10,6 +12,7 @@ SRP_LSH::SRP_LSH(					// constructor
 	: n_(n), d_(d), K_(K)
 {
 	m_ = (int) ceil(K / 64.0f);
+	assert(64 * m_ < 65536);		// hamming distances fit in uint16_t
 
 	// -------------------------------------------------------------------------
 	//  generate random projection vectors
@@ -23,19 +26,36 @@ SRP_LSH::SRP_LSH(					// constructor
 	}
 
 	// -------------------------------------------------------------------------
-	//  initialize lookup table for all uint16_t values
+	//  allocate space for the transposed hash keys (64-byte aligned word 
+	//  arrays, zero padding up to n_pad_ so kernels run on full blocks)
 	// -------------------------------------------------------------------------
-	int size = 1 << 16;
-	table16_ = new uint32_t[size];
-	for (int i = 0; i < size; ++i) {
-		table16_[i] = bit_count(i);
+	n_pad_ = (n + HAMMING_BLOCK - 1) / HAMMING_BLOCK * HAMMING_BLOCK;
+	int64_t bytes = SIZEUINT64 * (int64_t) n_pad_ * m_;
+
+	void *ptr = NULL;
+	if (posix_memalign(&ptr, 64, MAX(bytes, (int64_t) 64)) != 0) {
+		printf("Could not allocate %lld bytes\n", (long long) bytes);
+		exit(1);
 	}
+	sigs_ = (uint64_t *) ptr;
+	memset(sigs_, 0, bytes);
 
 	// -------------------------------------------------------------------------
-	//  allocate space for hash_key
+	//  split the hash codes into substrings of about log2(n) bits for mih
 	// -------------------------------------------------------------------------
-	hash_key_ = new uint64_t*[n];
-	for (int i = 0; i < n; ++i) hash_key_[i] = new uint64_t[m_];
+	mih_num_ = 0; mih_start_ = NULL; mih_keys_ = NULL;
+	mih_offset_ = NULL; mih_ids_ = NULL;
+	if (g_mih && n > 0) {
+		int bits = (int) round(log2((double) n));
+		bits = MAX(1, MIN(bits, MIH_MAX_BITS));
+
+		mih_num_   = (K + bits - 1) / bits;
+		mih_start_ = new int[mih_num_ + 1];
+		for (int t = 0; t <= mih_num_; ++t) {
+			mih_start_[t] = (int) ((int64_t) t * K / mih_num_);
+		}
+		mih_keys_ = new uint32_t[(int64_t) n * mih_num_];
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -46,20 +66,18 @@ SRP_LSH::~SRP_LSH()					// destructor
 	}
 	delete[] proj_;	proj_ = NULL; 
 
-	delete[] table16_; table16_ = NULL; 
-	
-	for (int i = 0; i < n_; ++i) {
-		delete[] hash_key_[i]; hash_key_[i] = NULL;
-	}
-	delete[] hash_key_; hash_key_ = NULL;
-}
+	free(sigs_); sigs_ = NULL;
 
-// -----------------------------------------------------------------------------
-inline uint32_t SRP_LSH::bit_count(	// count the number of 1 bits of x
-	uint32_t x) 						// input uint32_t value
-{
-    uint32_t num = x - ((x >> 1) & 033333333333) - ((x >> 2) & 011111111111);
-    return ((num + (num >> 3)) & 030707070707) % 63;
+	if (mih_num_ > 0) {
+		for (int t = 0; t < mih_num_; ++t) {
+			delete[] mih_offset_[t]; mih_offset_[t] = NULL;
+			delete[] mih_ids_[t];    mih_ids_[t]    = NULL;
+		}
+		delete[] mih_offset_; mih_offset_ = NULL;
+		delete[] mih_ids_;    mih_ids_    = NULL;
+		delete[] mih_keys_;   mih_keys_   = NULL;
+		delete[] mih_start_;  mih_start_  = NULL;
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -88,6 +106,66 @@ void SRP_LSH::compress_hash_code( 	// compress hash code with 64 bits
 	}
 }
 
+// -----------------------------------------------------------------------------
+void SRP_LSH::set_hash_code(		// set the hash key of a data object
+	int   id,							// data object id
+	const bool *hash_code)				// hash code of data object
+{
+	uint64_t *hash_key = new uint64_t[m_];
+	compress_hash_code(hash_code, hash_key);
+	for (int j = 0; j < m_; ++j) {
+		sigs_[(int64_t) j * n_pad_ + id] = hash_key[j];
+	}
+	delete[] hash_key; hash_key = NULL;
+
+	for (int t = 0; t < mih_num_; ++t) {
+		mih_keys_[(int64_t) id * mih_num_ + t] = get_substring(t, hash_code);
+	}
+}
+
+// -----------------------------------------------------------------------------
+uint32_t SRP_LSH::get_substring(	// get a substring of a hash code
+	int   t,							// substring id
+	const bool *hash_code)				// hash code
+{
+	uint32_t key = 0;
+	for (int j = mih_start_[t]; j < mih_start_[t+1]; ++j) {
+		key = (key << 1) | (hash_code[j] ? 1 : 0);
+	}
+	return key;
+}
+
+// -----------------------------------------------------------------------------
+void SRP_LSH::build_tables()		// build mih tables after all hash codes
+{
+	if (mih_num_ == 0) return;
+
+	// -------------------------------------------------------------------------
+	//  one direct-address table per substring: the ids of bucket b are 
+	//  mih_ids_[t][mih_offset_[t][b], mih_offset_[t][b+1]), in ascending order
+	// -------------------------------------------------------------------------
+	mih_offset_ = new uint32_t*[mih_num_];
+	mih_ids_    = new int*[mih_num_];
+	for (int t = 0; t < mih_num_; ++t) {
+		int64_t buckets = 1LL << (mih_start_[t+1] - mih_start_[t]);
+		uint32_t *offset = new uint32_t[buckets + 1];
+		memset(offset, 0, sizeof(uint32_t) * (buckets + 1));
+
+		for (int i = 0; i < n_; ++i) {
+			++offset[mih_keys_[(int64_t) i * mih_num_ + t] + 1];
+		}
+		for (int64_t b = 0; b < buckets; ++b) offset[b+1] += offset[b];
+
+		int *ids = new int[n_];
+		std::vector<uint32_t> pos(offset, offset + buckets);
+		for (int i = 0; i < n_; ++i) {
+			ids[pos[mih_keys_[(int64_t) i * mih_num_ + t]]++] = i;
+		}
+		mih_offset_[t] = offset;
+		mih_ids_[t]    = ids;
+	}
+}
+
 // -----------------------------------------------------------------------------
 void SRP_LSH::display()				// display parameters
 {
@@ -96,6 +174,11 @@ void SRP_LSH::display()				// display parameters
 	printf("    d = %d\n", d_);
 	printf("    K = %d\n", K_);
 	printf("    m = %d\n", m_);
+	printf("    hamming = %s\n", g_hamming.name_);
+	if (mih_num_ > 0) {
+		printf("    mih substrings = %d (%d-%d bits)\n", mih_num_, 
+			K_ / mih_num_, (K_ + mih_num_ - 1) / mih_num_);
+	}
 	printf("\n");
 }
 
@@ -112,25 +195,47 @@ int SRP_LSH::kmc(					// c-k-AMC search
 	for (int i = 0; i < K_; ++i) {
 		hash_code_q[i] = calc_hash_code(i, query);
 	}
+	int candidates = MIN(get_candidates(top_k), n_);
+	if (mih_num_ > 0 && kmc_mih(candidates, hash_code_q, cand) == 0) {
+		delete[] hash_code_q; hash_code_q = NULL;
+		return 0;
+	}
 	uint64_t *hash_key_q = new uint64_t[m_];
 	compress_hash_code((const bool*) hash_code_q, hash_key_q);
 
 	// -------------------------------------------------------------------------
-	//  find the candidates with largest matched values
+	//  find the candidates with largest matched values, i.e., smallest hamming
+	//  distances. distances are small integers in [0, 64*m_], so a histogram 
+	//  of them gives the threshold distance of the top candidates, and a 
+	//  second pass places them by counting sort. ties are broken by id as a 
+	//  MaxK_List would do (the earlier ids first)
 	// -------------------------------------------------------------------------
-	MaxK_List *list = new MaxK_List(CANDIDATES + top_k - 1);
 	int total_bits = 64 * m_;
-	for (int i = 0; i < n_; ++i) {
-		uint32_t match = 0;
-		for (int j = 0; j < m_; ++j) {
-			match += table_lookup(hash_key_[i][j] ^ hash_key_q[j]);
-		}
-		list->insert((float) (total_bits - match), i);
+	std::vector<uint16_t> dist(n_pad_);
+	std::vector<int> hist(total_bits + 1, 0);
+	g_hamming.func_(n_pad_, m_, n_pad_, sigs_, hash_key_q, &dist[0]);
+	for (int i = 0; i < n_; ++i) ++hist[dist[i]];
+
+	int thres = 0, before = 0;		// #objects with dist < thres
+	while (thres < total_bits && before + hist[thres] < candidates) {
+		before += hist[thres++];
+	}
+	std::vector<int> offset(thres + 1);
+	for (int t = 0, pos = 0; t <= thres; ++t) {
+		offset[t] = pos; pos += hist[t];
 	}
 
-	int size = list->size();
-	for (int i = 0; i < size; ++i) {
-		cand.push_back(list->ith_id(i));
+	int base  = (int) cand.size();
+	int quota = candidates - before;// #objects taken with dist == thres
+	cand.resize(base + candidates);
+	for (int i = 0; i < n_; ++i) {
+		int t = dist[i];
+		if (t < thres) {
+			cand[base + offset[t]++] = i;
+		}
+		else if (t == thres && quota > 0) {
+			cand[base + offset[t]++] = i; --quota;
+		}
 	}
 
 	// -------------------------------------------------------------------------
@@ -138,17 +243,96 @@ int SRP_LSH::kmc(					// c-k-AMC search
 	// -------------------------------------------------------------------------
 	delete[] hash_code_q; hash_code_q = NULL;
 	delete[] hash_key_q;  hash_key_q  = NULL;
-	delete list; list = NULL;
 
 	return 0;
 }
 
 // -----------------------------------------------------------------------------
-inline uint32_t SRP_LSH::table_lookup( // table lookup the match value
-	uint64_t x)							// input uint64_t value
+int SRP_LSH::kmc_mih(				// c-k-AMC search by multi-index hashing
+	int   candidates,					// number of candidates
+	const bool *hash_code_q,			// hash code of query
+	std::vector<int> &cand)				// MCS candidates (return)
 {
-	return table16_[x & 0xffff] + table16_[(x>>16) & 0xffff] + 
-		table16_[(x>>32) & 0xffff] + table16_[(x>>48) & 0xffff];
+	int num = mih_num_;
+	int max_bits = 0;
+	std::vector<uint32_t> key_q(num);
+	for (int t = 0; t < num; ++t) {
+		key_q[t] = get_substring(t, hash_code_q);
+		max_bits = MAX(max_bits, mih_start_[t+1] - mih_start_[t]);
+	}
+
+	// -------------------------------------------------------------------------
+	//  probe the buckets within radius r = 0, 1, ... of all tables. by the 
+	//  pigeonhole principle, once radius r has been probed in tables 0..t, an
+	//  object of distance <= num*r + t has been found. an object is only 
+	//  taken at its first hit, i.e., at the smallest distance of its 
+	//  substrings and in the first table of that distance.
+	//
+	//  if the codes are not close to the query, the probes soon cost more 
+	//  than a full scan (a probed entry costs about MIH_PROBE_COST codes of 
+	//  the scan); then give up (return 1) and let kmc scan all codes
+	// -------------------------------------------------------------------------
+	std::vector<int> hist(K_ + 1, 0);
+	std::vector<std::pair<int, int> > found; // (distance, id)
+	int64_t work = 0;				// buckets and entries probed
+	int  bound = -1;				// all objects with dist <= bound found
+	int  cnt   = 0;					// #objects with dist <= bound
+
+	for (int r = 0; r <= max_bits && cnt < candidates; ++r) {
+		for (int t = 0; t < num && cnt < candidates; ++t) {
+			int bits = mih_start_[t+1] - mih_start_[t];
+			if (r > bits) continue;
+
+			const uint32_t *offset = mih_offset_[t];
+			const int *ids = mih_ids_[t];
+			uint64_t mask  = (1ULL << r) - 1;
+			uint64_t limit = 1ULL << bits;
+			while (mask < limit) {
+				uint32_t bucket = key_q[t] ^ (uint32_t) mask;
+				work += 1 + offset[bucket+1] - offset[bucket];
+				for (uint32_t j = offset[bucket]; j < offset[bucket+1]; ++j) {
+					int id = ids[j];
+					const uint32_t *key = &mih_keys_[(int64_t) id * num];
+					int  dist  = 0;
+					bool first = true;
+					for (int u = 0; u < num; ++u) {
+						int du = __builtin_popcount(key[u] ^ key_q[u]);
+						if (du < r || (du == r && u < t)) {
+							first = false; break;
+						}
+						dist += du;
+					}
+					if (first) {
+						found.push_back(std::make_pair(dist, id)); ++hist[dist];
+					}
+				}
+				if (mask == 0) break;
+
+				// next mask of the same number of 1 bits (Gosper's hack)
+				uint64_t low = mask & (~mask + 1), high = mask + low;
+				mask = (((high ^ mask) >> 2) >> __builtin_ctzll(low)) | high;
+			}
+			if (work * MIH_PROBE_COST > n_) return 1;
+
+			int next = MIN(num * r + t, K_);
+			while (bound < next) cnt += hist[++bound];
+		}
+	}
+
+	// -------------------------------------------------------------------------
+	//  the candidates are the first ones of the complete range by (distance, 
+	//  id), the same as those of the full scan
+	// -------------------------------------------------------------------------
+	int size = 0;
+	for (size_t j = 0; j < found.size(); ++j) {
+		if (found[j].first <= bound) found[size++] = found[j];
+	}
+	found.resize(size);
+	std::partial_sort(found.begin(), found.begin() + candidates, found.end());
+
+	for (int j = 0; j < candidates; ++j) cand.push_back(found[j].second);
+
+	return 0;
 }
 
 } // end namespace mips
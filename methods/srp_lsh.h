@@ -9,9 +9,12 @@
 #include "util.h"
 #include "random.h"
 #include "pri_queue.h"
+#include "simd.h"
 
 namespace mips {
 
+extern bool g_mih;					// global param: multi-index hashing
+
 // -----------------------------------------------------------------------------
 //  Sign-Random Projection LSH (SRP_LSH) is used to solve the problem of 
 //  c-Approximate Maximum Cosine (c-AMC) search
@@ -20,6 +23,12 @@ namespace mips {
 //  estimation techniques from rounding algorithms", In Proceedings of the 
 //  thiry-fourth annual ACM symposium on Theory of computing (STOC), pages 
 //  380–388, 2002.
+//
+//  with g_mih, the K-bit hash codes are also split into mih_num_ substrings 
+//  of about log2(n) bits, each indexed by a direct-address table (multi-index
+//  hashing by Norouzi et al., CVPR 2012). kmc then probes the tables with 
+//  increasing radius instead of scanning all n codes, and stops as soon as 
+//  the candidates are known to be the same as those of the full scan.
 // -----------------------------------------------------------------------------
 class SRP_LSH {
 public:
@@ -27,9 +36,16 @@ public:
 	int      d_;					// dimensionality
 	int      K_;					// number of hash functions
 	int      m_;					// number of compressed uint64_t hash code
+	int      n_pad_;				// n_ rounded up to HAMMING_BLOCK
 	float    **proj_;				// random projection vectors
-	uint64_t **hash_key_;			// hash code of data objects
-	uint32_t *table16_;				// table to record the number of "1" bits
+	uint64_t *sigs_;				// hash keys of data objects (transposed:
+									// word j of object i at j*n_pad_+i)
+
+	int      mih_num_;				// number of substrings (0: no mih)
+	int      *mih_start_;			// first bit of substrings (mih_num_+1)
+	uint32_t *mih_keys_;			// substrings of object i at i*mih_num_
+	uint32_t **mih_offset_;			// start of buckets in mih_ids_ per table
+	int      **mih_ids_;			// ids sorted by bucket per table
 
 	// -------------------------------------------------------------------------
 	SRP_LSH(						// constructor
@@ -50,6 +66,14 @@ public:
 		const bool *hash_code,			// input hash code
 		uint64_t* hash_key);			// hash key (return)
 
+	// -------------------------------------------------------------------------
+	void set_hash_code(				// set the hash key of a data object
+		int   id,						// data object id
+		const bool *hash_code);			// hash code of data object
+
+	// -------------------------------------------------------------------------
+	void build_tables();			// build mih tables after all hash codes
+
 	// -------------------------------------------------------------------------
 	void display();					// display parameters
 
@@ -65,19 +89,30 @@ public:
 		int64_t ret = 0;
 		ret += sizeof(*this);
 		ret += SIZEFLOAT * K_ * d_;	// for proj
-		ret += SIZEINT * (1 << 16); // for table16_
-		ret += SIZEUINT64 * n_ * m_;; // for hash_key_
+		ret += SIZEUINT64 * (int64_t) n_pad_ * m_; // for sigs_
+		if (mih_num_ > 0) {
+			ret += SIZEINT * (mih_num_ + 1); // for mih_start_
+			ret += SIZEINT * (int64_t) n_ * mih_num_; // for mih_keys_
+			for (int t = 0; t < mih_num_; ++t) {
+				int bits = mih_start_[t+1] - mih_start_[t];
+				ret += SIZEINT * ((1LL << bits) + 1); // for mih_offset_
+				ret += SIZEINT * (int64_t) n_; // for mih_ids_
+			}
+		}
 		return ret;
 	}
 
 protected:
 	// -------------------------------------------------------------------------
-	uint32_t bit_count(				// count the number of 1 bits of x
-		uint32_t x); 					// input uint32_t value
+	uint32_t get_substring(			// get a substring of a hash code
+		int   t,						// substring id
+		const bool *hash_code);			// hash code
 
 	// -------------------------------------------------------------------------
-	uint32_t table_lookup(			// table lookup the match value
-		uint64_t x);					// input uint64_t value
+	int kmc_mih(					// c-k-AMC search by multi-index hashing
+		int   candidates,				// number of candidates
+		const bool *hash_code_q,		// hash code of query
+		std::vector<int> &cand);		// MCS candidates (return)
 };
 
 } // end namespace mips
@@ -0,0 +1,110 @@
+#include "stats.h"
+
+#include <mutex>
+#include <sys/stat.h>
+
+namespace mips {
+
+static Query_Stats g_total;			// totals of the run
+static std::mutex  g_total_mutex;	// protects g_total
+static thread_local Query_Stats t_local; // counters of this thread
+
+// -----------------------------------------------------------------------------
+Query_Stats::~Query_Stats()			// destructor (add to totals of thread)
+{
+	if (this != &t_local) return;
+
+	std::lock_guard<std::mutex> lock(g_total_mutex);
+	g_total.add(*this);
+}
+
+// -----------------------------------------------------------------------------
+void Query_Stats::clear()			// reset all counters
+{
+	queries_ = blocks_total_ = blocks_visited_ = blocks_linear_ = 0;
+	entries_ = collisions_ = candidates_ = ip_calls_ = ip_pruned_ = 0;
+	t_project_ = t_lookup_ = t_scan_ = t_verify_ = t_linear_ = 0;
+}
+
+// -----------------------------------------------------------------------------
+void Query_Stats::add(				// add the counters of another one
+	const Query_Stats &other)			// other counters
+{
+	queries_        += other.queries_;
+	blocks_total_   += other.blocks_total_;
+	blocks_visited_ += other.blocks_visited_;
+	blocks_linear_  += other.blocks_linear_;
+	entries_        += other.entries_;
+	collisions_     += other.collisions_;
+	candidates_     += other.candidates_;
+	ip_calls_       += other.ip_calls_;
+	ip_pruned_      += other.ip_pruned_;
+	t_project_      += other.t_project_;
+	t_lookup_       += other.t_lookup_;
+	t_scan_         += other.t_scan_;
+	t_verify_       += other.t_verify_;
+	t_linear_       += other.t_linear_;
+}
+
+// -----------------------------------------------------------------------------
+Query_Stats &local_stats()			// counters of the calling thread
+{
+	return t_local;
+}
+
+// -----------------------------------------------------------------------------
+void stats_reset()					// reset the totals and local counters
+{
+	std::lock_guard<std::mutex> lock(g_total_mutex);
+	g_total.clear();
+	t_local.clear();
+}
+
+// -----------------------------------------------------------------------------
+void stats_flush()					// add local counters to the totals
+{
+	std::lock_guard<std::mutex> lock(g_total_mutex);
+	g_total.add(t_local);
+	t_local.clear();
+}
+
+// -----------------------------------------------------------------------------
+void write_stats(					// append the totals to a table
+	const char *out_path,				// output path
+	const char *method_name,			// name of method
+	int   top_k)						// top-k value
+{
+	// -------------------------------------------------------------------------
+	//  one tab-separated line per (method, top-k), counters and times (ms)
+	//  averaged per query
+	// -------------------------------------------------------------------------
+	char fname[200];
+	sprintf(fname, "%sstats.tsv", out_path);
+
+	struct stat st;
+	bool  exists = stat(fname, &st) == 0;
+	FILE *fp = fopen(fname, "a+");
+	if (!fp) { printf("Could not create %s\n", fname); return; }
+
+	if (!exists) {
+		fprintf(fp, "method\ttop_k\tqueries\tblocks_visited\tblocks_skipped\t"
+			"blocks_linear\tentries\tcollisions\tcandidates\tip_full\t"
+			"ip_pruned\tproject_ms\tlookup_ms\tscan_ms\tverify_ms\t"
+			"linear_ms\n");
+	}
+	const Query_Stats &s = g_total;
+	double qn = (double) MAX(s.queries_, (int64_t) 1);
+	double ms = 1e6 * qn;			// ns in total to ms per query
+
+	fprintf(fp, "%s\t%d\t%lld\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t"
+		"%.3f\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\n", method_name, top_k,
+		(long long) s.queries_, s.blocks_visited_ / qn,
+		(s.blocks_total_ - s.blocks_visited_) / qn, s.blocks_linear_ / qn,
+		s.entries_ / qn, s.collisions_ / qn, s.candidates_ / qn,
+		(s.ip_calls_ - s.ip_pruned_) / qn, s.ip_pruned_ / qn,
+		s.t_project_ / ms, s.t_lookup_ / ms, s.t_scan_ / ms, s.t_verify_ / ms,
+		s.t_linear_ / ms);
+	fclose(fp);
+}
+
+} // end namespace mips
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <stdint.h>
+
+#include "def.h"
+
+namespace mips {
+
+// -----------------------------------------------------------------------------
+//  Query_Stats: counters of the stages of a query in H2_ALSH::kmip and
+//  QALSH::knn. they are only compiled in with -DMIPS_STATS (make STATS=1);
+//  otherwise the STATS_* macros expand to nothing and cost nothing.
+//
+//  each thread counts into its own Query_Stats (local_stats), which is added
+//  to the totals of the run when the thread exits or calls stats_flush, so
+//  the counters need no synchronization on the query path.
+// -----------------------------------------------------------------------------
+struct Query_Stats {
+	int64_t queries_;				// number of queries
+	int64_t blocks_total_;			// number of blocks of the queried indexes
+	int64_t blocks_visited_;		// blocks visited (not cut by norm bound)
+	int64_t blocks_linear_;			// blocks scanned linearly
+	int64_t entries_;				// table entries within search windows
+	int64_t collisions_;			// collision counter increments
+	int64_t candidates_;			// candidates produced by qalsh
+	int64_t ip_calls_;				// inner products with pruning
+	int64_t ip_pruned_;				// inner products pruned by partial norms
+	int64_t t_project_;				// time of projection (ns)
+	int64_t t_lookup_;				// time of lower_bound on tables (ns)
+	int64_t t_scan_;				// time of collision counting (ns)
+	int64_t t_verify_;				// time of verifying candidates (ns)
+	int64_t t_linear_;				// time of linear scans of blocks (ns)
+
+	// -------------------------------------------------------------------------
+	Query_Stats() { clear(); }		// constructor
+
+	// -------------------------------------------------------------------------
+	~Query_Stats();					// destructor (add to totals of thread)
+
+	// -------------------------------------------------------------------------
+	void clear();					// reset all counters
+
+	// -------------------------------------------------------------------------
+	void add(						// add the counters of another one
+		const Query_Stats &other);		// other counters
+};
+
+typedef std::chrono::steady_clock Stats_Clock;
+
+// -----------------------------------------------------------------------------
+Query_Stats &local_stats();			// counters of the calling thread
+
+// -----------------------------------------------------------------------------
+void stats_reset();					// reset the totals and local counters
+
+// -----------------------------------------------------------------------------
+void stats_flush();					// add local counters to the totals
+
+// -----------------------------------------------------------------------------
+void write_stats(					// append the totals to a table
+	const char *out_path,				// output path
+	const char *method_name,			// name of method
+	int   top_k);						// top-k value
+
+// -----------------------------------------------------------------------------
+inline int64_t stats_elapsed(		// elapsed time since a start time (ns)
+	Stats_Clock::time_point start)		// start time
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		Stats_Clock::now() - start).count();
+}
+
+#ifdef MIPS_STATS
+#define STATS_ADD(field, val)	(local_stats().field += (val))
+#define STATS_START(t)			Stats_Clock::time_point t = Stats_Clock::now()
+#define STATS_STOP(field, t)	(local_stats().field += stats_elapsed(t))
+#else
+#define STATS_ADD(field, val)	((void) 0)
+#define STATS_START(t)			((void) 0)
+#define STATS_STOP(field, t)	((void) 0)
+#endif
+
+} // end namespace mips
@@ -1,4 +1,7 @@
 #include "util.h"
+#include "parallel.h"
+#include "simd.h"
+#include "stats.h"
 
 namespace mips {
 
@@ -11,6 +14,44 @@ float   g_indextime = -1.0f;		// global param: indexing time (seconds)
 float   g_runtime   = -1.0f;		// global param: running time (ms)
 float   g_ratio     = -1.0f;		// global param: overall ratio
 float   g_recall    = -1.0f;		// global param: recall (%)
+float   g_qps       = -1.0f;		// global param: queries per second
+float   g_p50       = -1.0f;		// global param: median latency (ms)
+float   g_p95       = -1.0f;		// global param: 95th percentile latency (ms)
+float   g_p99       = -1.0f;		// global param: 99th percentile latency (ms)
+float   g_max       = -1.0f;		// global param: max latency (ms)
+int     g_lat_hist[LAT_BINS] = { 0 }; // global param: queries per latency bin
+
+int     g_num_threads = std::max(1, (int) std::thread::hardware_concurrency());
+int     g_query_threads = 1;		// global param: number of query threads
+
+std::vector<int> g_topk = { 1,2,5,10 }; // global param: top-k values
+int     g_max_k     = 10;			// global param: max top-k value
+
+// -----------------------------------------------------------------------------
+int set_topk(						// set top-k values from a list "k1,k2,..."
+	const char *list)					// comma separated top-k values
+{
+	std::vector<int> topk;
+	const char *p = list;
+	while (*p != '\0') {
+		char *e = NULL;
+		long k = strtol(p, &e, 10);
+		if (e == p || k <= 0 || k > MAXINT) return 1;
+		topk.push_back((int) k);
+
+		p = e;
+		if (*p == ',') ++p;
+		else if (*p != '\0') return 1;
+	}
+	if (topk.empty()) return 1;
+
+	std::sort(topk.begin(), topk.end());
+	topk.erase(std::unique(topk.begin(), topk.end()), topk.end());
+	g_topk  = topk;
+	g_max_k = topk.back();
+
+	return 0;
+}
 
 // -----------------------------------------------------------------------------
 void create_dir(					// create dir if the path exists
@@ -34,6 +75,213 @@ void create_dir(					// create dir if the path exists
 	}
 }
 
+// -----------------------------------------------------------------------------
+//  Fast text parsing: the file is mapped, split into chunks on line boundaries,
+//  and the chunks are parsed in parallel by hand-written number parsers.
+// -----------------------------------------------------------------------------
+static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 
+	1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 
+	1e21, 1e22 };
+
+// -----------------------------------------------------------------------------
+static inline bool is_space(		// whether ch separates two numbers
+	char ch)							// input char
+{
+	return ch == ' ' || ch == '\t' || ch == '\r' || ch == ',';
+}
+
+// -----------------------------------------------------------------------------
+static inline bool parse_float(		// parse a float from [p, end)
+	const char *&p,						// current position (return)
+	const char *end,					// end of line
+	float &val)							// float value (return)
+{
+	while (p < end && is_space(*p)) ++p;
+	if (p >= end) return false;
+
+	const char *start = p;
+	bool neg = (*p == '-');
+	if (*p == '-' || *p == '+') ++p;
+
+	// keep at most 19 significant digits in an integer mantissa
+	uint64_t mant = 0;
+	int  digits = 0, exp10 = 0;
+	bool found  = false;
+	while (p < end && *p >= '0' && *p <= '9') {
+		if (digits < 19) { mant = mant * 10 + (*p - '0'); if (mant) ++digits; }
+		else ++exp10;
+		++p; found = true;
+	}
+	if (p < end && *p == '.') {
+		++p;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 19) {
+				mant = mant * 10 + (*p - '0'); if (mant) ++digits;
+				--exp10;
+			}
+			++p; found = true;
+		}
+	}
+	if (found && p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool eneg = (q < end && *q == '-');
+		if (q < end && (*q == '-' || *q == '+')) ++q;
+		if (q < end && *q >= '0' && *q <= '9') {
+			int e = 0;
+			while (q < end && *q >= '0' && *q <= '9') {
+				if (e < 10000) e = e * 10 + (*q - '0');
+				++q;
+			}
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+	if (!found || (p < end && !is_space(*p) && *p != '\n')) {
+		// rare formats (e.g., inf, nan): fall back to strtof on a copy
+		char buf[64];
+		int  len = 0;
+		p = start;
+		while (p < end && !is_space(*p) && *p != '\n' && len < 63) {
+			buf[len++] = *p++;
+		}
+		buf[len] = '\0';
+		while (p < end && !is_space(*p) && *p != '\n') ++p;
+
+		char *stop = NULL;
+		val = strtof(buf, &stop);
+		return stop != buf;
+	}
+
+	double v = (double) mant;
+	if (exp10 < 0) v = exp10 >= -22 ? v / POW10[-exp10] : v * pow(10.0, exp10);
+	else if (exp10 > 0) v = exp10 <= 22 ? v * POW10[exp10] : v * pow(10.0, exp10);
+	val = (float) (neg ? -v : v);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+static inline bool parse_int(		// parse an integer from [p, end)
+	const char *&p,						// current position (return)
+	const char *end,					// end of line
+	int   &val)							// integer value (return)
+{
+	while (p < end && is_space(*p)) ++p;
+	if (p >= end) return false;
+
+	bool neg = (*p == '-');
+	if (*p == '-' || *p == '+') ++p;
+	if (p >= end || *p < '0' || *p > '9') return false;
+
+	int64_t v = 0;
+	while (p < end && *p >= '0' && *p <= '9') v = v * 10 + (*p++ - '0');
+	val = (int) (neg ? -v : v);
+
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+static inline bool is_blank(		// whether [begin, end) has no token
+	const char *begin,					// begin of line
+	const char *end)					// end of line
+{
+	for (const char *p = begin; p < end; ++p) {
+		if (!is_space(*p)) return false;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+static void set_min_line(			// keep the first bad line of all threads
+	std::atomic<int> &bad,				// first bad line (MAXINT: none)
+	int   line)							// a bad line
+{
+	int cur = bad.load(std::memory_order_relaxed);
+	while (line < cur && !bad.compare_exchange_weak(cur, line)) {}
+}
+
+// -----------------------------------------------------------------------------
+template<class Func>
+static int parse_lines(				// parse lines of a text file in parallel
+	const char *fname,					// address of text file
+	int   skip,							// number of leading lines to skip
+	int   num,							// max number of lines to parse
+	Func  func)							// func(i, begin, end) for i-th line
+{
+	// return the number of (non-blank) lines parsed, or -1 if cannot open
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) return -1;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) { close(fd); return -1; }
+	int64_t size = st.st_size;
+	if (size == 0) { close(fd); return 0; }
+
+	const char *buf = (const char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, 
+		fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) return -1;
+	madvise((void *) buf, size, MADV_SEQUENTIAL);
+
+	const char *end = buf + size;
+	const char *pos = buf;
+	for (int i = 0; i < skip && pos < end; ++i) {
+		const char *nl = (const char *) memchr(pos, '\n', end - pos);
+		pos = nl ? nl + 1 : end;
+	}
+
+	// -------------------------------------------------------------------------
+	//  split the file into chunks on line boundaries
+	// -------------------------------------------------------------------------
+	int num_chunks = (int) MAX(1, MIN((end - pos) >> 20, g_num_threads * 8));
+	std::vector<const char*> bounds(num_chunks + 1, end);
+	bounds[0] = pos;
+	for (int c = 1; c < num_chunks; ++c) {
+		const char *p = pos + (end - pos) / num_chunks * c;
+		if (p < bounds[c - 1]) p = bounds[c - 1];
+		const char *nl = (const char *) memchr(p, '\n', end - p);
+		bounds[c] = nl ? nl + 1 : end;
+	}
+
+	// -------------------------------------------------------------------------
+	//  count the lines of each chunk to get the line id of its first line
+	// -------------------------------------------------------------------------
+	std::vector<int> first(num_chunks + 1, 0);
+	parallel_for(num_chunks, 1, [&](int /*tid*/, int begin, int stop) {
+		for (int c = begin; c < stop; ++c) {
+			int cnt = 0;
+			const char *p = bounds[c];
+			while (p < bounds[c + 1]) {
+				const char *nl = (const char *) memchr(p, '\n', bounds[c+1] - p);
+				const char *e  = nl ? nl : bounds[c + 1];
+				if (!is_blank(p, e)) ++cnt;
+				p = e + 1;
+			}
+			first[c + 1] = cnt;
+		}
+	});
+	for (int c = 0; c < num_chunks; ++c) first[c + 1] += first[c];
+
+	// -------------------------------------------------------------------------
+	//  parse the chunks
+	// -------------------------------------------------------------------------
+	parallel_for(num_chunks, 1, [&](int /*tid*/, int begin, int stop) {
+		for (int c = begin; c < stop; ++c) {
+			int i = first[c];
+			const char *p = bounds[c];
+			while (p < bounds[c + 1] && i < num) {
+				const char *nl = (const char *) memchr(p, '\n', bounds[c+1] - p);
+				const char *e  = nl ? nl : bounds[c + 1];
+				if (!is_blank(p, e)) func(i++, p, e);
+				p = e + 1;
+			}
+		}
+	});
+	munmap((void *) buf, size);
+
+	return MIN(first[num_chunks], num);
+}
+
 // -----------------------------------------------------------------------------
 int read_txt_data(					// read data (text) from disk
 	int   n,							// number of data objects
@@ -44,38 +292,29 @@ int read_txt_data(					// read data (text) from disk
 	float **norm_d)						// l2-norm of data objects (return)
 {
 	gettimeofday(&g_start_time, NULL);
-	FILE *fp = fopen(fname, "r");
-	if (!fp) {
-		printf("Could not open %s\n", fname);
-		return 1;
-	}
 
-	int i = 0;
-	int j = 0;
-	while (!feof(fp) && i < n) {
+	// each line is "id v_1 v_2 ... v_d"; norms are calculated in the same pass
+	std::atomic<int> bad(MAXINT);
+	int num = parse_lines(fname, 0, n, [&](int i, const char *p, const char *e) {
+		int   id  = -1;
 		float tmp = 0.0f;
-		memset(norm_d[i], 0.0f, NORM_K * SIZEFLOAT);
-
-		fscanf(fp, "%d", &j);
-		for (j = 0; j < d; ++j) {
-			fscanf(fp, " %f", &tmp);
+		bool  ok  = parse_int(p, e, id);
+		for (int j = 0; j < d && ok; ++j) {
+			ok = parse_float(p, e, tmp);
 			data[i][j] = tmp;
-
-			norm_d[i][0] += tmp*tmp;
-			for (int t = 1; t < NORM_K; ++t) {
-				if (j < 8*t) norm_d[i][t] += tmp*tmp;
-			}
-		}
-		fscanf(fp, "\n");
-
-		for (int t = 1; t < NORM_K; ++t) {
-			norm_d[i][t] = sqrt(norm_d[i][0] - norm_d[i][t]);
 		}
-		norm_d[i][0] = sqrt(norm_d[i][0]);
-		++i;
+		if (!ok) set_min_line(bad, i);
+		calc_norms(d, data[i], norm_d[i]);
+	});
+	if (num < 0) {
+		printf("Could not open %s\n", fname);
+		return 1;
+	}
+	if (num != n || bad < MAXINT) {
+		printf("%s: %d lines read, line %d has less than %d values\n", fname, 
+			num, bad < MAXINT ? (int) bad : -1, d);
+		return 1;
 	}
-	assert(feof(fp) && i == n);
-	fclose(fp);
 
 	gettimeofday(&g_end_time, NULL);
 	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
@@ -106,26 +345,351 @@ int read_bin_data(					// read data (binary) from disk
 	int i = 0;
 	while (!feof(fp) && i < n) {
 		fread(data[i], SIZEFLOAT, d, fp);
+		calc_norms(d, data[i], norm_d[i]);
+		++i;
+	}
+	fclose(fp);
 
-		// calc norm_d
-		memset(norm_d[i], 0.0f, NORM_K * SIZEFLOAT);
-		float tmp = 0.0f;
-		for (int j = 0; j < d; ++j) {
-			tmp = data[i][j];
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+	if (flag) printf("Read Data : %f Seconds\n", running_time);
+	else printf("Read Query: %f Seconds\n", running_time);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int mmap_bin_data(					// map data (binary) from disk (zero copy)
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	const char *fname,					// address of data
+	Dataset **dset)						// data objects and l2-norms (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open %s\n", fname);
+		return 1;
+	}
+
+	struct stat st;
+	int64_t bytes = (int64_t) n * d * SIZEFLOAT;
+	if (fstat(fd, &st) != 0 || st.st_size < bytes) {
+		printf("%s is smaller than %d x %d floats\n", fname, n, d);
+		close(fd);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  map the file read-only, pages are loaded lazily and shared
+	// -------------------------------------------------------------------------
+	void *addr = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		printf("Could not mmap %s\n", fname);
+		return 1;
+	}
+	Dataset *ds = new Dataset(n, d, addr, bytes);
+	*dset = ds;
+
+	// -------------------------------------------------------------------------
+	//  load l2-norms from the sidecar file if it is up to date; otherwise, 
+	//  calc them in parallel and write the sidecar file for the next run
+	// -------------------------------------------------------------------------
+	char norm_set[300];
+	sprintf(norm_set, "%s.norm", fname);
 
-			norm_d[i][0] += SQR(tmp);
-			for (int t = 1; t < NORM_K; ++t) {
-				if (j < 8 * t) norm_d[i][t] += SQR(tmp);
+	bool loaded = false;
+	struct stat nst;
+	if (stat(norm_set, &nst) == 0 && nst.st_mtime >= st.st_mtime) {
+		FILE *fp = fopen(norm_set, "rb");
+		if (fp) {
+			int header[3] = { -1, -1, -1 };
+			int pos[MAX_NORM_K - 1];
+			fread(header, SIZEINT, 3, fp);
+			if (header[0] == n && header[1] == d && header[2] == ds->norm_k_ &&
+				(int) fread(pos, SIZEINT, g_prune.num_, fp) == g_prune.num_ &&
+				memcmp(pos, g_prune.pos_, g_prune.num_ * SIZEINT) == 0) {
+				int64_t size = (int64_t) n * ds->norm_k_;
+				loaded = (int64_t) fread(ds->norm_, SIZEFLOAT, size, fp) == size;
 			}
+			fclose(fp);
 		}
-		for (int t = 1; t < NORM_K; ++t) {
-			norm_d[i][t] = sqrt(norm_d[i][0] - norm_d[i][t]);
+	}
+	if (!loaded) {
+		parallel_for(n, 1024, [&](int /*tid*/, int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				calc_norms(d, ds->row(i), ds->norm(i));
+			}
+		});
+
+		FILE *fp = fopen(norm_set, "wb");
+		if (fp) {
+			int header[3] = { n, d, ds->norm_k_ };
+			fwrite(header, SIZEINT, 3, fp);
+			fwrite(g_prune.pos_, SIZEINT, g_prune.num_, fp);
+			fwrite(ds->norm_, SIZEFLOAT, (int64_t) n * ds->norm_k_, fp);
+			fclose(fp);
 		}
-		norm_d[i][0] = sqrt(norm_d[i][0]);
-		++i;
 	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+
+	if (flag) printf("Map Data  : %f Seconds\n", running_time);
+	else printf("Map Query : %f Seconds\n", running_time);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+void calc_norms(					// calc l2-norm and partial l2-norms
+	int   d,							// dimensionality
+	const float *data,					// data object
+	float *norm)						// l2-norms (return, get_norm_k() values)
+{
+	// norm[0] is the l2-norm; norm[t] (t > 0) is the l2-norm of the suffix 
+	// after the first g_prune.pos_[t-1] dimensions, used by calc_inner_product
+	// for pruning
+	int   norm_k = get_norm_k();
+	int   t = 1;
+	float sum = 0.0f;
+	for (int j = 0; j < d; ++j) {
+		while (t < norm_k && j == g_prune.pos_[t-1]) norm[t++] = sum;
+		sum += SQR(data[j]);
+	}
+	while (t < norm_k) norm[t++] = sum;
+
+	for (t = 1; t < norm_k; ++t) {
+		norm[t] = sqrt(sum - norm[t]);
+	}
+	norm[0] = sqrt(sum);
+}
+
+// -----------------------------------------------------------------------------
+int read_dataset(					// read data set of any supported format
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	bool  use_mmap,						// map binary files (zero copy)
+	bool  huge_page,					// use huge pages
+	const char *fname,					// address of data set
+	Dataset **dset)						// data objects and l2-norms (return)
+{
+	if (vecs_type(fname) == 0 && use_mmap) {
+		return mmap_bin_data(n, d, flag, fname, dset);
+	}
+
+	Dataset *ds = new Dataset(n, d, huge_page);
+	*dset = ds;
+	if (vecs_type(fname) != 0) {
+		return read_vecs_data(n, d, flag, fname, ds->rows_, ds->norm_rows_);
+	}
+	int len = (int) strlen(fname);
+	if (len > 4 && strcmp(fname + len - 4, ".txt") == 0) {
+		return read_txt_data(n, d, flag, fname, ds->rows_, ds->norm_rows_);
+	}
+	return read_bin_data(n, d, flag, fname, ds->rows_, ds->norm_rows_);
+}
+
+// -----------------------------------------------------------------------------
+void reorder_dims(					// reorder dims by variance (descending)
+	Dataset *dset,						// data objects and l2-norms (return)
+	Dataset *qset)						// query objects and l2-norms (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	int n = dset->n_;
+	int d = dset->d_;
+
+	// -------------------------------------------------------------------------
+	//  calc the variance of each dimension with per-thread partial sums
+	// -------------------------------------------------------------------------
+	int num_threads = MAX(g_num_threads, 1);
+	std::vector<double> sum((int64_t) num_threads * d * 2, 0.0);
+	parallel_for(n, 1024, [&](int tid, int begin, int end) {
+		double *s1 = &sum[(int64_t) tid * d * 2];
+		double *s2 = s1 + d;
+		for (int i = begin; i < end; ++i) {
+			const float *p = dset->row(i);
+			for (int j = 0; j < d; ++j) {
+				s1[j] += p[j];
+				s2[j] += (double) p[j] * p[j];
+			}
+		}
+	});
+
+	std::vector<Result> var(d);
+	for (int j = 0; j < d; ++j) {
+		double s1 = 0.0, s2 = 0.0;
+		for (int t = 0; t < num_threads; ++t) {
+			s1 += sum[(int64_t) t * d * 2 + j];
+			s2 += sum[(int64_t) t * d * 2 + d + j];
+		}
+		var[j].id_  = j;
+		var[j].key_ = (float) (s2 / n - SQR(s1 / n));
+	}
+	std::stable_sort(var.begin(), var.end(), 
+		[](const Result &a, const Result &b) { return a.key_ > b.key_; });
+
+	// -------------------------------------------------------------------------
+	//  permute data and query objects in the same way (inner products are 
+	//  unchanged) and re-calc the partial l2-norms under the new order
+	// -------------------------------------------------------------------------
+	std::vector<int> perm(d);
+	for (int j = 0; j < d; ++j) perm[j] = var[j].id_;
+
+	Dataset *sets[2] = { dset, qset };
+	for (int k = 0; k < 2; ++k) {
+		Dataset *ds = sets[k];
+		if (ds == NULL) continue;
+
+		ds->permute_dims(&perm[0]);
+		parallel_for(ds->n_, 1024, [&](int /*tid*/, int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				calc_norms(d, ds->row(i), ds->norm(i));
+			}
+		});
+	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Reorder Dims: %f Seconds\n\n", running_time);
+}
+
+// -----------------------------------------------------------------------------
+char vecs_type(						// get the type of a .fvecs/.bvecs/.ivecs file
+	const char *fname)					// address of file
+{
+	// return 'f' (float), 'b' (uint8), 'i' (int32), or 0 for other formats
+	int len = (int) strlen(fname);
+	if (len < 6 || strcmp(fname + len - 4, "vecs") != 0) return 0;
+
+	char type = fname[len - 5];
+	if (fname[len - 6] != '.') return 0;
+	if (type != 'f' && type != 'b' && type != 'i') return 0;
+	return type;
+}
+
+// -----------------------------------------------------------------------------
+int get_vecs_info(					// infer n and d from a vecs file
+	const char *fname,					// address of vecs file
+	int   *n,							// number of vectors (return)
+	int   *d)							// dimensionality (return)
+{
+	char type = vecs_type(fname);
+	FILE *fp  = fopen(fname, "rb");
+	if (!fp || type == 0) {
+		printf("Could not open %s\n", fname);
+		if (fp) fclose(fp);
+		return 1;
+	}
+
+	// every vector is stored as (int32 d, d elements); use the first header
+	int dim = -1;
+	fread(&dim, SIZEINT, 1, fp);
+	fseeko(fp, 0, SEEK_END);
+	int64_t size = (int64_t) ftello(fp);
 	fclose(fp);
 
+	int64_t row_size = SIZEINT + (int64_t) dim * (type == 'b' ? 1 : 4);
+	if (dim <= 0 || size % row_size != 0) {
+		printf("%s is not a valid %cvecs file\n", fname, type);
+		return 1;
+	}
+	*d = dim;
+	*n = (int) (size / row_size);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+static int read_vecs_chunk(			// read a chunk of vectors from vecs file
+	FILE  *fp,							// file pointer
+	char  type,							// type of vecs file
+	int   d,							// dimensionality
+	int   num,							// max number of vectors to read
+	char  *buf,							// buffer (num * row size bytes)
+	float *out)							// vectors (return, num * d floats)
+{
+	// return the number of vectors read, or -1 if a header does not match d
+	int elem     = type == 'b' ? 1 : 4;
+	int row_size = SIZEINT + d * elem;
+	int cnt      = (int) fread(buf, row_size, num, fp);
+
+	for (int i = 0; i < cnt; ++i) {
+		const char *row = buf + (int64_t) i * row_size;
+		int dim = -1;
+		memcpy(&dim, row, SIZEINT);
+		if (dim != d) return -1;
+
+		const char *vec = row + SIZEINT;
+		float *dst = out + (int64_t) i * d;
+		if (type == 'f') {
+			memcpy(dst, vec, d * SIZEFLOAT);
+		}
+		else if (type == 'b') {
+			const uint8_t *v = (const uint8_t *) vec;
+			for (int j = 0; j < d; ++j) dst[j] = (float) v[j];
+		}
+		else {
+			for (int j = 0; j < d; ++j) {
+				int val; memcpy(&val, vec + j * SIZEINT, SIZEINT);
+				dst[j] = (float) val;
+			}
+		}
+	}
+	return cnt;
+}
+
+// -----------------------------------------------------------------------------
+int read_vecs_data(					// read data (fvecs/bvecs/ivecs) from disk
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	const char *fname,					// address of vecs file
+	float **data,						// data objects (return)
+	float **norm_d)						// l2-norm of data objects (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	char type = vecs_type(fname);
+	FILE *fp  = fopen(fname, "rb");
+	if (!fp || type == 0) {
+		printf("Could not open %s\n", fname);
+		if (fp) fclose(fp);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  stream the file in chunks of VECS_CHUNK vectors
+	// -------------------------------------------------------------------------
+	int   elem = type == 'b' ? 1 : 4;
+	char  *buf = new char[(int64_t) VECS_CHUNK * (SIZEINT + d * elem)];
+	float *vec = new float[(int64_t) VECS_CHUNK * d];
+
+	int i = 0;
+	while (i < n) {
+		int num = read_vecs_chunk(fp, type, d, MIN(VECS_CHUNK, n-i), buf, vec);
+		if (num <= 0) break;
+
+		for (int j = 0; j < num; ++j, ++i) {
+			memcpy(data[i], vec + (int64_t) j * d, d * SIZEFLOAT);
+			calc_norms(d, data[i], norm_d[i]);
+		}
+	}
+	fclose(fp);
+	delete[] buf;
+	delete[] vec;
+
+	if (i != n) {
+		printf("%s has only %d valid vectors of dimension %d\n", fname, i, d);
+		return 1;
+	}
+
 	gettimeofday(&g_end_time, NULL);
 	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
 		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
@@ -136,6 +700,55 @@ int read_bin_data(					// read data (binary) from disk
 	return 0;
 }
 
+// -----------------------------------------------------------------------------
+int convert_vecs_data(				// convert a vecs file to a binary file
+	const char *fname,					// address of vecs file
+	const char *out_fname)				// address of binary file (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	int n = -1, d = -1;
+	if (get_vecs_info(fname, &n, &d)) return 1;
+
+	FILE *fp = fopen(fname, "rb");
+	if (!fp) { printf("Could not open %s\n", fname); return 1; }
+	FILE *ofp = fopen(out_fname, "wb");
+	if (!ofp) { printf("Could not create %s\n", out_fname); fclose(fp); return 1; }
+
+	// -------------------------------------------------------------------------
+	//  stream the file in chunks and write raw floats (the .ds/.q format)
+	// -------------------------------------------------------------------------
+	char  type = vecs_type(fname);
+	int   elem = type == 'b' ? 1 : 4;
+	char  *buf = new char[(int64_t) VECS_CHUNK * (SIZEINT + d * elem)];
+	float *vec = new float[(int64_t) VECS_CHUNK * d];
+
+	int i = 0;
+	while (i < n) {
+		int num = read_vecs_chunk(fp, type, d, MIN(VECS_CHUNK, n-i), buf, vec);
+		if (num <= 0) break;
+
+		fwrite(vec, SIZEFLOAT, (int64_t) num * d, ofp);
+		i += num;
+	}
+	fclose(fp);
+	fclose(ofp);
+	delete[] buf;
+	delete[] vec;
+
+	if (i != n) {
+		printf("%s has only %d valid vectors of dimension %d\n", fname, i, d);
+		return 1;
+	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Convert %s (n = %d, d = %d) to %s: %f Seconds\n", fname, n, d, 
+		out_fname, running_time);
+
+	return 0;
+}
+
 // -----------------------------------------------------------------------------
 int read_ground_truth(				// read ground truth results from disk
 	int qn,								// number of query objects
@@ -152,15 +765,85 @@ int read_ground_truth(				// read ground truth results from disk
 	int tmp1 = -1;
 	int tmp2 = -1;
 	fscanf(fp, "%d %d\n", &tmp1, &tmp2);
-	assert(tmp1 == qn && tmp2 == MAXK);
+	fclose(fp);
+	if (tmp1 < qn || tmp2 < g_max_k) {
+		printf("%s has %d x %d results, need at least %d x %d\n", fname, 
+			tmp1, tmp2, qn, g_max_k);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  each line is "id_1 ip_1 id_2 ip_2 ... id_k ip_k" of a query; the truth 
+	//  file may be wider than g_max_k, only the first g_max_k are parsed
+	// -------------------------------------------------------------------------
+	std::atomic<int> bad(MAXINT);
+	int num = parse_lines(fname, 1, qn, [&](int i, const char *p, const char *e) {
+		bool ok = true;
+		for (int j = 0; j < g_max_k && ok; ++j) {
+			ok = parse_int(p, e, R[i][j].id_) && parse_float(p, e, R[i][j].key_);
+		}
+		if (!ok) set_min_line(bad, i);
+	});
+	if (num != qn || bad < MAXINT) {
+		printf("%s: %d lines read, line %d has less than %d results\n", fname, 
+			num, bad < MAXINT ? (int) bad : -1, g_max_k);
+		return 1;
+	}
+
+	gettimeofday(&g_end_time, NULL);
+	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
+		(g_end_time.tv_usec - g_start_time.tv_usec) / 1000000.0f;
+	printf("Read Truth: %f Seconds\n\n", running_time);
+
+	return 0;
+}
+
+// -----------------------------------------------------------------------------
+int read_vecs_truth(				// read ground truth ids (ivecs) from disk
+	int   n,							// number of data objects
+	int   qn,							// number of query objects
+	int   d,							// dimensionality
+	const char *fname,					// address of truth set
+	const float **data,					// data objects
+	const float **query,				// query objects
+	Result **R)							// ground truth results (return)
+{
+	gettimeofday(&g_start_time, NULL);
+	int num = -1, k = -1;
+	if (get_vecs_info(fname, &num, &k)) return 1;
+	if (num < qn || k < g_max_k) {
+		printf("%s has %d x %d ids, need at least %d x %d\n", fname, num, k, 
+			qn, g_max_k);
+		return 1;
+	}
+
+	// -------------------------------------------------------------------------
+	//  ivecs truth files only store (0-based) ids, so that the inner products 
+	//  are re-computed and the results are sorted in descending order
+	// -------------------------------------------------------------------------
+	FILE *fp = fopen(fname, "rb");
+	if (!fp) { printf("Could not open %s\n", fname); return 1; }
 
+	int    *ids = new int[k + 1];
+	Result *res = new Result[k];
 	for (int i = 0; i < qn; ++i) {
-		for (int j = 0; j < MAXK; ++j) {
-			fscanf(fp, "%d %f ", &R[i][j].id_, &R[i][j].key_);
+		fread(ids, SIZEINT, k + 1, fp);
+		for (int j = 0; j < k; ++j) {
+			int id = ids[j + 1];
+			if (id < 0 || id >= n) {
+				printf("%s has an invalid id %d\n", fname, id);
+				fclose(fp); delete[] ids; delete[] res;
+				return 1;
+			}
+			res[j].id_  = id + 1;
+			res[j].key_ = calc_inner_product(d, data[id], query[i]);
 		}
-		fscanf(fp, "\n");
+		qsort(res, k, sizeof(Result), ResultCompDesc);
+		for (int j = 0; j < g_max_k; ++j) R[i][j] = res[j];
 	}
 	fclose(fp);
+	delete[] ids;
+	delete[] res;
 
 	gettimeofday(&g_end_time, NULL);
 	float running_time = g_end_time.tv_sec - g_start_time.tv_sec + 
@@ -176,9 +859,9 @@ void write_pre_recall(				// write precision-recall curves to disk
 	const float **pre,					// precision 
 	const float **recall)				// recall
 {
-	for (int r = 0; r < MAX_ROUND; ++r) {
-		printf("Top-%d\t\tRecall\t\tPrecision\n", TOPK[r]);
-		fprintf(fp, "Top-%d\tRecall\t\tPrecision\n", TOPK[r]);
+	for (int r = 0; r < (int) g_topk.size(); ++r) {
+		printf("Top-%d\t\tRecall\t\tPrecision\n", g_topk[r]);
+		fprintf(fp, "Top-%d\tRecall\t\tPrecision\n", g_topk[r]);
 		
 		for (int t = 0; t < MAX_T; ++t) {
 			printf("%4d\t\t%.2f\t\t%.2f\n", tMIPs[t], recall[r][t], pre[r][t]);
@@ -197,11 +880,7 @@ float calc_inner_product(			// calc inner product
 	const float *p1,					// 1st point
 	const float *p2)					// 2nd point
 {
-	float ret = 0.0f;
-	for (int i = 0; i < dim; ++i) {
-		ret += p1[i] * p2[i];
-	}
-	return ret;
+	return g_ip.ip_(dim, p1, p2);	// SIMD kernel selected at startup
 }
 
 // -----------------------------------------------------------------------------
@@ -213,64 +892,8 @@ float calc_inner_product(			// calc inner product
 	const float *p2,					// 2nd point
 	const float *norm2) 				// l2-norm of 2nd point
 {
-	float ip = 0.0f;
-	int base = 0;
-	for (int t = 1; t < NORM_K; ++t) {
-		int end = base + 8;
-		for (int i = base; i < end; ++i) {
-			ip += p1[i] * p2[i];
-		}
-		if (ip + norm1[t]*norm2[t] <= threshold) return ip; 
-		base += 8;
-	}
-	for (int i = base; i < dim; ++i) {
-		ip += p1[i] * p2[i];
-	}
-	return ip;
-
-	// unsigned d = dim & ~unsigned(7);
-	// const float *aa = p1, *end_a = aa + d;
-	// const float *bb = p2, *end_b = bb + d;
-
-	// float r = 0.0f;
-	// float r0, r1, r2, r3, r4, r5, r6, r7;
-
-	// const float *a = aa, *b = bb;
-	// int t = 1;
-	// for (; a < end_a; a += 8, b += 8) {
-	// 	__builtin_prefetch(a+32, 0, 3);
-	// 	__builtin_prefetch(b+32, 0, 0);
-
-	// 	r0 = a[0] * b[0];
-	// 	r1 = a[1] * b[1];
-	// 	r2 = a[2] * b[2];
-	// 	r3 = a[3] * b[3];
-	// 	r4 = a[4] * b[4];
-	// 	r5 = a[5] * b[5];
-	// 	r6 = a[6] * b[6];
-	// 	r7 = a[7] * b[7];
-
-	// 	r += r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7;
-
-	// 	if (t < NORM_K && r+norm1[t]*norm2[t] <= threshold) return r;
-	// 	++t;
-	// }
-	// __builtin_prefetch(a, 0, 3);
-	// __builtin_prefetch(b, 0, 0);
-
-	// r0 = r1 = r2 = r3 = r4 = r5 = r6 = r7 = 0.0f;
-	// switch (dim & 7) {
-	// 	case 7: r6 = a[6] * b[6];
-	// 	case 6: r5 = a[5] * b[5];
-	// 	case 5: r4 = a[4] * b[4];
-	// 	case 4: r3 = a[3] * b[3];
-	// 	case 3: r2 = a[2] * b[2];
-	// 	case 2: r1 = a[1] * b[1];
-	// 	case 1: r0 = a[0] * b[0];
-	// }
-	// r += r0 + r1 + r2 + r3 + r4 + r5 + r6 + r7;
-	
-	// return r;
+	STATS_ADD(ip_calls_, 1);
+	return g_ip.ip_prune_(dim, threshold, p1, norm1, p2, norm2);
 }
 
 // -----------------------------------------------------------------------------
@@ -325,6 +948,18 @@ float calc_l2_sqr(					// calc L2 square distance
 	return r;
 }
 
+// -----------------------------------------------------------------------------
+//  the kernels of different SIMD levels (and the block kernels that compute 
+//  the truth sets) sum in different orders, so inner products are compared 
+//  with a tolerance relative to their magnitude rather than with an absolute 
+//  one, whichever kernel computed them.
+// -----------------------------------------------------------------------------
+static inline float key_tolerance(	// tolerance of comparing a key
+	float key)							// key (inner product)
+{
+	return MAX(FLOATZERO, RELZERO * fabs(key));
+}
+
 // -----------------------------------------------------------------------------
 float calc_ratio(					// calc overall ratio
 	int   k,							// top-k value
@@ -337,7 +972,9 @@ float calc_ratio(					// calc overall ratio
 	// consider geometric mean instead of arithmetic mean for overall ratio
 	float sum = 0.0f, r = -1.0f;
 	for (int j = 0; j < k; ++j) {
-		if (fabs(list->ith_key(j) - R[j].key_) < FLOATZERO) r = 1.0f;
+		if (fabs(list->ith_key(j) - R[j].key_) < key_tolerance(R[j].key_)) {
+			r = 1.0f;
+		}
 		else r = (list->ith_key(j) + 1e-9) / (R[j].key_ + 1e-9);
 		sum += log(r);
 	}
@@ -352,7 +989,8 @@ float calc_recall(					// calc recall of mip results
 {
 	int i = list->size() - 1;
 	int last = k - 1;
-	while (i >= 0 && R[last].key_ - list->ith_key(i) > FLOATZERO) {
+	float eps = key_tolerance(R[last].key_);
+	while (i >= 0 && R[last].key_ - list->ith_key(i) > eps) {
 		--i;
 	}
 	return (i + 1) * 100.0f / k;
@@ -367,7 +1005,8 @@ int get_hits(						// get the number of hits between two ID list
 {
 	int i = k - 1;
 	int last = t - 1;
-	while (i >= 0 && R[last].key_ - list->ith_key(i) > FLOATZERO) --i;
+	float eps = key_tolerance(R[last].key_);
+	while (i >= 0 && R[last].key_ - list->ith_key(i) > eps) --i;
 
 	return MIN(t, i + 1);
 }
@@ -429,4 +1068,54 @@ int norm_distribution(				// analyse norm distribution of data
 	return 0;
 }
 
+// -----------------------------------------------------------------------------
+static inline uint64_t checksum_round(// mix a word into a lane of checksum64
+	uint64_t lane,						// lane
+	uint64_t word)						// word
+{
+	lane += word * 0xC2B2AE3D27D4EB4FULL;
+	lane  = (lane << 31) | (lane >> 33);
+	return lane * 0x9E3779B185EBCA87ULL;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t checksum64(				// calc 64-bit checksum of a buffer
+	const void *buf,					// buffer
+	int64_t size)						// size of buffer (bytes)
+{
+	// -------------------------------------------------------------------------
+	//  four independent lanes of 64-bit words (as the rounds of xxHash64), so 
+	//  that a large buffer is checked at about the speed of memory
+	// -------------------------------------------------------------------------
+	const char *p = (const char *) buf;
+	uint64_t lane[4] = { 1, 2, 3, 4 };
+	int64_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		uint64_t w[4];
+		memcpy(w, p + i, 32);
+		for (int j = 0; j < 4; ++j) lane[j] = checksum_round(lane[j], w[j]);
+	}
+	uint64_t tail[4] = { 0, 0, 0, 0 };
+	memcpy(tail, p + i, size - i);
+	for (int j = 0; j < 4; ++j) lane[j] = checksum_round(lane[j], tail[j]);
+
+	uint64_t ret = (uint64_t) size;
+	for (int j = 0; j < 4; ++j) ret = checksum_round(ret ^ lane[j], lane[j]);
+	return ret ^ (ret >> 29);
+}
+
+// -----------------------------------------------------------------------------
+int write_padding(					// pad a file with zeros to an alignment
+	FILE  *fp,							// file pointer (at the end of file)
+	int64_t align)						// alignment (bytes)
+{
+	static const char zeros[INDEX_PAGE] = { 0 };
+	assert(align <= INDEX_PAGE);
+
+	int64_t pos = (int64_t) ftello(fp);
+	if (pos < 0) return 1;
+	int64_t pad = (align - pos % align) % align;
+	return fwrite(zeros, 1, pad, fp) == (size_t) pad ? 0 : 1;
+}
+
 } // end namespace mips
@@ -12,9 +12,12 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "def.h"
 #include "pri_queue.h"
+#include "dataset.h"
 
 namespace mips {
 	
@@ -27,6 +30,30 @@ extern float   g_indextime;			// global param: indexing time
 extern float   g_runtime;			// global param: running time
 extern float   g_ratio;				// global param: overall ratio
 extern float   g_recall;			// global param: recall
+extern float   g_qps;				// global param: queries per second
+extern float   g_p50;				// global param: median latency
+extern float   g_p95;				// global param: 95th percentile latency
+extern float   g_p99;				// global param: 99th percentile latency
+extern float   g_max;				// global param: max latency
+extern int     g_lat_hist[LAT_BINS];// global param: latency histogram
+
+extern int     g_num_threads;		// global param: number of threads
+extern int     g_query_threads;		// global param: number of query threads
+
+extern std::vector<int> g_topk;		// global param: top-k values (ascending)
+extern int     g_max_k;				// global param: max top-k value
+
+// -----------------------------------------------------------------------------
+int set_topk(						// set top-k values from a list "k1,k2,..."
+	const char *list);					// comma separated top-k values
+
+// -----------------------------------------------------------------------------
+inline int get_candidates(			// candidate budget of a top-k query
+	int   top_k)						// top-k value
+{
+	// CANDIDATES extra candidates for small k, CAND_PER_K per result for large k
+	return MAX(CANDIDATES + top_k - 1, CAND_PER_K * top_k);
+}
 
 // -----------------------------------------------------------------------------
 void create_dir(					// create dir if the path exists
@@ -50,12 +77,75 @@ int read_bin_data(					// read data (binary) from disk
 	float **data,						// data objects (return)
 	float **norm_d);					// l2-norm of data objects (return)
 
+// -----------------------------------------------------------------------------
+int mmap_bin_data(					// map data (binary) from disk (zero copy)
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	const char *fname,					// address of data
+	Dataset **dset);					// data objects and l2-norms (return)
+
+// -----------------------------------------------------------------------------
+void calc_norms(					// calc l2-norm and partial l2-norms
+	int   d,							// dimensionality
+	const float *data,					// data object
+	float *norm);						// l2-norms (return, get_norm_k() values)
+
+// -----------------------------------------------------------------------------
+int read_dataset(					// read data set of any supported format
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	bool  use_mmap,						// map binary files (zero copy)
+	bool  huge_page,					// use huge pages
+	const char *fname,					// address of data set
+	Dataset **dset);					// data objects and l2-norms (return)
+
+// -----------------------------------------------------------------------------
+void reorder_dims(					// reorder dims by variance (descending)
+	Dataset *dset,						// data objects and l2-norms (return)
+	Dataset *qset);						// query objects and l2-norms (return)
+
+// -----------------------------------------------------------------------------
+char vecs_type(						// get the type of a .fvecs/.bvecs/.ivecs file
+	const char *fname);					// address of file
+
+// -----------------------------------------------------------------------------
+int get_vecs_info(					// infer n and d from a vecs file
+	const char *fname,					// address of vecs file
+	int   *n,							// number of vectors (return)
+	int   *d);							// dimensionality (return)
+
+// -----------------------------------------------------------------------------
+int read_vecs_data(					// read data (fvecs/bvecs/ivecs) from disk
+	int   n,							// number of data objects
+	int   d,							// dimensionality
+	bool  flag,							// true - data; false - query
+	const char *fname,					// address of vecs file
+	float **data,						// data objects (return)
+	float **norm_d);					// l2-norm of data objects (return)
+
+// -----------------------------------------------------------------------------
+int convert_vecs_data(				// convert a vecs file to a binary file
+	const char *fname,					// address of vecs file
+	const char *out_fname);				// address of binary file (return)
+
 // -----------------------------------------------------------------------------
 int read_ground_truth(				// read ground truth results from disk
 	int    qn,							// number of query objects
 	const  char *fname,					// address of truth set
 	Result **R);						// ground truth results (return)
 
+// -----------------------------------------------------------------------------
+int read_vecs_truth(				// read ground truth ids (ivecs) from disk
+	int   n,							// number of data objects
+	int   qn,							// number of query objects
+	int   d,							// dimensionality
+	const char *fname,					// address of truth set
+	const float **data,					// data objects
+	const float **query,				// query objects
+	Result **R);						// ground truth results (return)
+
 // -----------------------------------------------------------------------------
 void write_pre_recall(				// write precision-recall curves to disk
 	FILE  *fp,							// file pointer
@@ -111,4 +201,14 @@ int norm_distribution(				// analyse norm distribution of data
 	const float **norm_d,				// l2-norm of data objects
 	const char  *out_path);				// output path
 
+// -----------------------------------------------------------------------------
+uint64_t checksum64(				// calc 64-bit checksum of a buffer
+	const void *buf,					// buffer
+	int64_t size);						// size of buffer (bytes)
+
+// -----------------------------------------------------------------------------
+int write_padding(					// pad a file with zeros to an alignment
+	FILE  *fp,							// file pointer (at the end of file)
+	int64_t align);						// alignment (bytes)
+
 } // end namespace mips
@@ -16,6 +16,7 @@ XBox::XBox(							// constructor
 	// -------------------------------------------------------------------------
 	lsh_ = new QALSH(n, d + 1, nn_ratio);
 	lsh_->display();
+	scratch_ = new QALSH_Scratch(n, lsh_->m_);
 
 	// -------------------------------------------------------------------------
 	//  calculate the Euclidean norm of data and find the maximum norm of data
@@ -46,9 +47,7 @@ XBox::XBox(							// constructor
 			lsh_->tables_[j][i].key_ = lsh_->calc_hash_value(j, xbox_data);
 		}
 	}
-	for (int i = 0; i < m; ++i) {
-		qsort(lsh_->tables_[i], n, sizeof(Result), ResultComp);
-	}
+	lsh_->build_tables();
 
 	// -------------------------------------------------------------------------
 	//  release space
@@ -61,6 +60,7 @@ XBox::XBox(							// constructor
 XBox::~XBox()						// destructor
 {
 	if (lsh_ != NULL) { delete lsh_; lsh_ = NULL; }
+	if (scratch_ != NULL) { delete scratch_; scratch_ = NULL; }
 }
 
 // -----------------------------------------------------------------------------
@@ -79,7 +79,8 @@ int XBox::kmip(						// c-k-AMIP search
 	bool  used_new_transform,			// used new transformation
 	const float *query,					// input query
 	const float *norm_q,				// l2-norm of query
-	MaxK_List *list)					// top-k MIP results (return) 
+	MaxK_List *list,					// top-k MIP results (return)
+	QALSH_Scratch *scratch)			// working space (NULL: own one)
 {
 	// -------------------------------------------------------------------------
 	//  construct XBox query
@@ -97,7 +98,9 @@ int XBox::kmip(						// c-k-AMIP search
 	//  find candidates by qalsh
 	// -------------------------------------------------------------------------
 	std::vector<int> cand;
-	lsh_->knn(top_k, MAXREAL, (const float *) xbox_query, cand);
+	QALSH_Scratch *work = acquire_scratch(scratch, scratch_);
+	lsh_->knn(top_k, MAXREAL, (const float *) xbox_query, cand, work);
+	release_scratch(work, scratch, scratch_);
 
 	// -------------------------------------------------------------------------
 	//  check candidates by calculating actual inner product value with query